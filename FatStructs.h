@@ -3,6 +3,7 @@
 
 static const uint8_t BOOTSIG0 = 0X55; /// Value for byte 510 of boot block or MBR
 uint8_t const BOOTSIG1 = 0XAA; // Value for byte 511 of boot block or MBR
+uint8_t const EXTENDED_BOOT_SIG = 0X29; // Value for bootSignature if serial number and label are valid
 
 /**
  * \struct partitionTable
@@ -256,10 +257,192 @@ uint32_t const FAT32EOC = 0X0FFFFFFF;
 uint32_t const FAT32EOC_MIN = 0X0FFFFFF8;
 /** Mask a for FAT32 entry. Entries are 28 bits. */
 uint32_t const FAT32MASK = 0X0FFFFFFF;
+/** FAT16 entry for a bad cluster. */
+uint16_t const FAT16BAD = 0XFFF7;
+/** FAT32 entry for a bad cluster. */
+uint32_t const FAT32BAD = 0X0FFFFFF7;
+/** FAT16 FAT[1] bit that is set if the volume was cleanly unmounted. */
+uint16_t const FAT16_CLEAN_SHUTDOWN = 0X8000;
+/** FAT32 FAT[1] bit that is set if the volume was cleanly unmounted. */
+uint32_t const FAT32_CLEAN_SHUTDOWN = 0X08000000;
 
 /** Type name for fat32BootSector */
 typedef struct fat32BootSector fbs_t;
 //------------------------------------------------------------------------------
+/**
+ * \struct exFatBootSector
+ *
+ * \brief Boot sector for an exFAT volume.
+ */
+struct exFatBootSector {
+    /** X86 jmp to boot program */
+    uint8_t  jmpToBootCode[3];
+    /** "EXFAT   " for an exFAT volume */
+    uint8_t  oemName[8];
+    /** Zero so FAT code does not mistake the volume for FAT */
+    uint8_t  mustBeZero[53];
+    /** Block number of the volume on the device */
+    uint64_t partitionOffset;
+    /** Size of the volume in blocks */
+    uint64_t volumeLength;
+    /** Block offset of the first FAT from the start of the volume */
+    uint32_t fatOffset;
+    /** Size of a FAT in blocks */
+    uint32_t fatLength;
+    /** Block offset of cluster two from the start of the volume */
+    uint32_t clusterHeapOffset;
+    /** Number of clusters in the cluster heap */
+    uint32_t clusterCount;
+    /** First cluster of the root directory */
+    uint32_t rootDirectoryCluster;
+    /** usually generated by combining date and time */
+    uint32_t volumeSerialNumber;
+    /** High byte is major revision number, low byte minor, 1.00 is 0X100 */
+    uint16_t fileSystemRevision;
+    /** Bit 0 active FAT, bit 1 volume dirty, bit 2 media failure */
+    uint16_t volumeFlags;
+    /** Log2 of bytes per sector, must be 9 for this library */
+    uint8_t  bytesPerSectorShift;
+    /** Log2 of sectors per cluster */
+    uint8_t  sectorsPerClusterShift;
+    /** Number of FATs, two only for TexFAT */
+    uint8_t  numberOfFats;
+    /** for int0x13 use value 0X80 for hard drive */
+    uint8_t  driveSelect;
+    /** Percentage of clusters in use or 0XFF if not known */
+    uint8_t  percentInUse;
+    /** reserved */
+    uint8_t  reserved[7];
+    /** X86 boot code */
+    uint8_t  bootCode[390];
+    /** must be 0X55 */
+    uint8_t  bootSectorSig0;
+    /** must be 0XAA */
+    uint8_t  bootSectorSig1;
+}__attribute__ ((packed));
+/** Type name for exFatBootSector */
+typedef struct exFatBootSector xbs_t;
+/** exFAT end of chain value. */
+uint32_t const EXFAT_EOC = 0XFFFFFFFF;
+/** exFAT volumeFlags bit that is set while the volume has unfinished changes. */
+uint16_t const EXFAT_VOLUME_DIRTY = 0X0002;
+//------------------------------------------------------------------------------
+/**
+ * \struct exFatFileEntry
+ * \brief exFAT file directory entry, the first entry of an entry set
+ *
+ * Timestamps have the FAT date in the high word and the FAT time in
+ * the low word.
+ */
+struct exFatFileEntry {
+    /** EXFAT_TYPE_FILE */
+    uint8_t  type;
+    /** Number of entries that follow in the set */
+    uint8_t  secondaryCount;
+    /** Checksum of all entries in the set, see SdFile */
+    uint16_t setChecksum;
+    /** Same bits as DIR_ATT_ values */
+    uint16_t attributes;
+    /** reserved */
+    uint16_t reserved1;
+    /** Time file was created. */
+    uint32_t createTimestamp;
+    /** Time of last write. */
+    uint32_t modifyTimestamp;
+    /** Time of last access. */
+    uint32_t accessTimestamp;
+    /** Hundredths of a second to add to createTimestamp */
+    uint8_t  create10ms;
+    /** Hundredths of a second to add to modifyTimestamp */
+    uint8_t  modify10ms;
+    /** Offset from UTC of createTimestamp */
+    uint8_t  createUtcOffset;
+    /** Offset from UTC of modifyTimestamp */
+    uint8_t  modifyUtcOffset;
+    /** Offset from UTC of accessTimestamp */
+    uint8_t  accessUtcOffset;
+    /** reserved */
+    uint8_t  reserved2[7];
+}__attribute__ ((packed));
+/** Type name for exFatFileEntry */
+typedef struct exFatFileEntry xdf_t;
+/**
+ * \struct exFatStreamEntry
+ * \brief exFAT stream extension entry, the second entry of a set
+ */
+struct exFatStreamEntry {
+    /** EXFAT_TYPE_STREAM */
+    uint8_t  type;
+    /** See EXFAT_FLAG_ values */
+    uint8_t  flags;
+    /** reserved */
+    uint8_t  reserved1;
+    /** Length of the name in characters */
+    uint8_t  nameLength;
+    /** Hash of the up-cased name, see SdFile */
+    uint16_t nameHash;
+    /** reserved */
+    uint16_t reserved2;
+    /** Bytes of the file that have been written */
+    uint64_t validDataLength;
+    /** reserved */
+    uint32_t reserved3;
+    /** First cluster of the file, zero if the file is empty */
+    uint32_t firstCluster;
+    /** Size of the file in bytes */
+    uint64_t dataLength;
+}__attribute__ ((packed));
+/** Type name for exFatStreamEntry */
+typedef struct exFatStreamEntry xds_t;
+/**
+ * \struct exFatNameEntry
+ * \brief exFAT file name entry, holds 15 characters of the name
+ */
+struct exFatNameEntry {
+    /** EXFAT_TYPE_NAME */
+    uint8_t  type;
+    /** reserved */
+    uint8_t  flags;
+    /** UTF-16 name characters */
+    uint16_t name[15];
+}__attribute__ ((packed));
+/** Type name for exFatNameEntry */
+typedef struct exFatNameEntry xdn_t;
+/**
+ * \struct exFatBitmapEntry
+ * \brief exFAT allocation bitmap entry in the root directory
+ */
+struct exFatBitmapEntry {
+    /** EXFAT_TYPE_BITMAP */
+    uint8_t  type;
+    /** Bit 0 is zero for the first bitmap */
+    uint8_t  flags;
+    /** reserved */
+    uint8_t  reserved[18];
+    /** First cluster of the bitmap */
+    uint32_t firstCluster;
+    /** Size of the bitmap in bytes */
+    uint64_t dataLength;
+}__attribute__ ((packed));
+/** Type name for exFatBitmapEntry */
+typedef struct exFatBitmapEntry xdb_t;
+/** exFAT entry type bit for an entry in use */
+uint8_t const EXFAT_TYPE_IN_USE = 0X80;
+/** exFAT entry type for end of directory, all following entries are free */
+uint8_t const EXFAT_TYPE_END = 0X00;
+/** exFAT entry type for allocation bitmap */
+uint8_t const EXFAT_TYPE_BITMAP = 0X81;
+/** exFAT entry type for file */
+uint8_t const EXFAT_TYPE_FILE = 0X85;
+/** exFAT entry type for stream extension */
+uint8_t const EXFAT_TYPE_STREAM = 0XC0;
+/** exFAT entry type for file name */
+uint8_t const EXFAT_TYPE_NAME = 0XC1;
+/** exFAT stream flag - clusters may be allocated */
+uint8_t const EXFAT_FLAG_ALLOC_POSSIBLE = 0X01;
+/** exFAT stream flag - clusters are contiguous and the FAT is not used */
+uint8_t const EXFAT_FLAG_NO_FAT_CHAIN = 0X02;
+//------------------------------------------------------------------------------
 /**
  * \struct directoryEntry
  * \brief FAT short directory entry
@@ -387,4 +570,37 @@ static inline uint8_t DIR_IS_SUBDIR(const dir_t* dir) {
 static inline uint8_t DIR_IS_FILE_OR_SUBDIR(const dir_t* dir) {
     return (dir->attributes & DIR_ATT_VOLUME_ID) == 0;
 }
+//------------------------------------------------------------------------------
+/**
+ * \struct longDirectoryEntry
+ * \brief FAT long name directory entry, holds 13 characters of a long name
+ *
+ * The entries for a long name are stored in reverse order just before the
+ * short name entry of the file.  The first entry has the
+ * LDIR_ORD_LAST_LONG_ENTRY bit set in ord.
+ */
+struct longDirectoryEntry {
+    /** Position of this entry in the long name, the first part is one. */
+    uint8_t  ord;
+    /** Characters 1-5 of this part of the name, UTF-16. */
+    uint16_t name1[5];
+    /** DIR_ATT_LONG_NAME */
+    uint8_t  attributes;
+    /** Zero for a long name entry. */
+    uint8_t  type;
+    /** Checksum of the short name that follows the long name entries. */
+    uint8_t  checksum;
+    /** Characters 6-11 of this part of the name, UTF-16. */
+    uint16_t name2[6];
+    /** Must be zero. */
+    uint16_t firstClusterLow;
+    /** Characters 12-13 of this part of the name, UTF-16. */
+    uint16_t name3[2];
+}__attribute__ ((packed));
+/** Type name for longDirectoryEntry */
+typedef struct longDirectoryEntry ldir_t;
+/** ord bit for the first entry of a long name, the last part of the name */
+uint8_t const LDIR_ORD_LAST_LONG_ENTRY = 0X40;
+/** Number of name characters in a long name entry */
+uint8_t const LDIR_NAME_CHARS = 13;
 #endif  // FatStructs_h
@@ -19,7 +19,7 @@ inline void DMAEvent(){
 }
 
 
-Sd2Card::Sd2Card() : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0), HardwareSPI(1) {
+Sd2Card::Sd2Card() : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0), inWrite_(0), inRead_(0), readNext_(0XFFFFFFFF), HardwareSPI(1) {
     this->begin(SPI_18MHZ, MSBFIRST, 0);
     //init DMA
     dma_init(DMA1);
@@ -44,6 +44,19 @@ uint8_t Sd2Card::spiRec(void)  {
 
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
     readEnd();
+#if SD_MULTI_BLOCK_READ
+    // end any multiple block read started by readData()
+    if (inRead_) {
+        inRead_ = 0;
+        if (!readStop()) 
+            return 0XFF;
+    }
+#endif  // SD_MULTI_BLOCK_READ
+#if SD_MULTI_BLOCK_WRITE
+    // end any multiple block write started by writeBlock()
+    if (!writeEnd()) 
+        return 0XFF;
+#endif  // SD_MULTI_BLOCK_WRITE
     CS0;
     waitNotBusy(300);
     
@@ -118,7 +131,8 @@ uint8_t Sd2Card::eraseSingleBlockEnable(void) {
 
 
 uint8_t Sd2Card::init() {
-    errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+    errorCode_ = inBlock_ = partialBlockRead_ = type_ = inWrite_ = inRead_ = 0;
+    readNext_ = 0XFFFFFFFF;
     uint16_t t0 = (uint16_t)millis();
     uint32_t arg;
 
@@ -195,6 +209,10 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
     return readData(block, 0, 512, dst);
 }
 
+// Read part of a block.  With SD_MULTI_BLOCK_READ a whole block that follows
+// the last whole block read is taken from a CMD18 sequence, so the card reads
+// ahead while the caller uses the block.  The sequence ends with the next
+// card command.
 uint8_t Sd2Card::readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t* dst) {
     
     uint16_t n;
@@ -202,6 +220,26 @@ uint8_t Sd2Card::readData(uint32_t block, uint16_t offset, uint16_t count, uint8
     if (count == 0) return true;
     if ((count + offset) > 512) goto fail;
     
+#if SD_MULTI_BLOCK_READ
+    if (count == 512) {
+        if (block == readNext_) {
+            // start a new sequence if one is not active
+            if (!inRead_) {
+                if (!readStart(block)) 
+                    goto fail;
+                inRead_ = 1;
+            }
+            if (!readData(dst)) {
+                inRead_ = 0;
+                readStop();
+                goto fail;
+            }
+            readNext_++;
+            return true;
+        }
+        readNext_ = block + 1;
+    }
+#endif  // SD_MULTI_BLOCK_READ
     if (!inBlock_ || block != block_ || offset < offset_) {
         block_ = block;
         // use address if not SDHC card
@@ -235,23 +273,7 @@ uint8_t Sd2Card::readData(uint32_t block, uint16_t offset, uint16_t count, uint8
     offset_ = offset;
     
     // transfer data
-    dma_setup_transfer(DMA1, DMA_CH2, &SPI1->regs->DR, DMA_SIZE_8BITS, dst, DMA_SIZE_8BITS,
-                       (DMA_MINC_MODE | DMA_TRNS_CMPLT | DMA_TRNS_ERR));
-    dma_attach_interrupt(DMA1, DMA_CH2, DMAEvent);
-    dma_setup_transfer(DMA1, DMA_CH3, &SPI1->regs->DR, DMA_SIZE_8BITS, ack, DMA_SIZE_8BITS,
-                       (/*DMA_MINC_MODE | DMA_CIRC_MODE |*/ DMA_FROM_MEM));             
-    dma_set_priority(DMA1, DMA_CH2, DMA_PRIORITY_VERY_HIGH);
-    dma_set_priority(DMA1, DMA_CH3, DMA_PRIORITY_VERY_HIGH);
-    dma_set_num_transfers(DMA1, DMA_CH2, count);
-    dma_set_num_transfers(DMA1, DMA_CH3, count);
-    
-    dmaActive = true;
-    dma_enable(DMA1, DMA_CH3);
-    dma_enable(DMA1, DMA_CH2);
-    
-    while(dmaActive) delayMicroseconds(1);
-    dma_disable(DMA1, DMA_CH3);
-    dma_disable(DMA1, DMA_CH2);
+    spiRead(dst, count);
     
     offset_ += count;
     if (!partialBlockRead_ || offset_ >= SPI_BUFF_SIZE) {
@@ -265,6 +287,59 @@ fail:
     return false;
 }
 
+// read the next block of a multiple block read started by readStart()
+uint8_t Sd2Card::readData(uint8_t* dst) {
+    // wait for the start token of the next block
+    if (!waitStartBlock()) 
+        goto fail;
+
+    spiRead(dst, 512);
+
+    spiRec();  // get first crc byte
+    spiRec();  // get second crc byte
+    return true;
+
+fail:
+    SerialUSB.println("Error: Sd2Card::readData()");
+    return false;
+}
+
+// Read count sequential blocks.  The blocks continue the current
+// multiple block read if they follow the last block read, else a new
+// one is started.
+uint8_t Sd2Card::readBlocks(uint32_t blockNumber, uint32_t count, uint8_t* dst) {
+#if SD_MULTI_BLOCK_READ
+    if (!inRead_ || blockNumber != readNext_) {
+        if (!readStart(blockNumber)) 
+            goto fail;
+        inRead_ = 1;
+    }
+    for (uint32_t i = 0; i < count; i++, dst += 512) {
+        if (!readData(dst)) {
+            inRead_ = 0;
+            readStop();
+            goto fail;
+        }
+    }
+    readNext_ = blockNumber + count;
+    return true;
+#else  // SD_MULTI_BLOCK_READ
+    if (!readStart(blockNumber)) 
+        goto fail;
+    for (uint32_t i = 0; i < count; i++, dst += 512) {
+        if (!readData(dst)) {
+            readStop();
+            goto fail;
+        }
+    }
+    return readStop();
+#endif  // SD_MULTI_BLOCK_READ
+
+fail:
+    SerialUSB.println("Error: Sd2Card::readBlocks");
+    return false;
+}
+
 void Sd2Card::readEnd(void) {
     if (inBlock_) {
         dma_setup_transfer(DMA1, DMA_CH3, &SPI1->regs->DR, DMA_SIZE_8BITS, ack, DMA_SIZE_8BITS,
@@ -307,6 +382,61 @@ fail:
     return false;
 }
 
+// start a multiple block read sequence, blocks are read with readData(dst)
+uint8_t Sd2Card::readStart(uint32_t blockNumber) {
+    // use address if not SDHC card
+    if (type() != SD_CARD_TYPE_SDHC) 
+        blockNumber <<= 9;
+    if (cardCommand(CMD18, blockNumber)) {
+        error(SD_CARD_ERROR_CMD18);
+        SerialUSB.println("Error: CMD18");
+        goto fail;
+    }
+    return true;
+
+fail:
+    CS1;
+    SerialUSB.println("Error: Sd2Card::readStart()");
+    return false;
+}
+
+// end a multiple block read sequence
+uint8_t Sd2Card::readStop(void) {
+    if (cardCommand(CMD12, 0)) {
+        error(SD_CARD_ERROR_CMD12);
+        SerialUSB.println("Error: CMD12");
+        goto fail;
+    }
+    CS1;
+    return true;
+
+fail:
+    CS1;
+    SerialUSB.println("Error: Sd2Card::readStop()");
+    return false;
+}
+
+// receive count bytes into dst using DMA
+void Sd2Card::spiRead(uint8_t* dst, uint16_t count) {
+    dma_setup_transfer(DMA1, DMA_CH2, &SPI1->regs->DR, DMA_SIZE_8BITS, dst, DMA_SIZE_8BITS,
+                       (DMA_MINC_MODE | DMA_TRNS_CMPLT | DMA_TRNS_ERR));
+    dma_attach_interrupt(DMA1, DMA_CH2, DMAEvent);
+    dma_setup_transfer(DMA1, DMA_CH3, &SPI1->regs->DR, DMA_SIZE_8BITS, ack, DMA_SIZE_8BITS,
+                       (/*DMA_MINC_MODE | DMA_CIRC_MODE |*/ DMA_FROM_MEM));             
+    dma_set_priority(DMA1, DMA_CH2, DMA_PRIORITY_VERY_HIGH);
+    dma_set_priority(DMA1, DMA_CH3, DMA_PRIORITY_VERY_HIGH);
+    dma_set_num_transfers(DMA1, DMA_CH2, count);
+    dma_set_num_transfers(DMA1, DMA_CH3, count);
+    
+    dmaActive = true;
+    dma_enable(DMA1, DMA_CH3);
+    dma_enable(DMA1, DMA_CH2);
+    
+    while(dmaActive) delayMicroseconds(1);
+    dma_disable(DMA1, DMA_CH3);
+    dma_disable(DMA1, DMA_CH2);
+}
+
 uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
     uint16_t t0 = millis();
     do {
@@ -342,6 +472,9 @@ fail:
     return false;
 }
 
+// Write a block.  With SD_MULTI_BLOCK_WRITE a block that follows the last
+// block written is sent in the same CMD25 sequence.  The sequence ends with
+// the next card command or a call to writeEnd().
 uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
 #if SD_PROTECT_BLOCK_ZERO
     // don't allow write to first block
@@ -352,6 +485,21 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
     }
 #endif  // SD_PROTECT_BLOCK_ZERO
 
+#if SD_MULTI_BLOCK_WRITE
+    // start a new sequence if block does not follow last block written
+    if (!inWrite_ || blockNumber != writeNext_) {
+        if (!writeStart(blockNumber, 0)) 
+            goto fail;
+        inWrite_ = 1;
+    }
+    if (!writeData(src)) {
+        // send stop token so the card leaves the CMD25 sequence
+        writeStop();
+        goto fail;
+    }
+    writeNext_ = blockNumber + 1;
+    return true;
+#else  // SD_MULTI_BLOCK_WRITE
     // use address if not SDHC card
     if (type() != SD_CARD_TYPE_SDHC) 
         blockNumber <<= 9;
@@ -377,6 +525,7 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
     }
     CS1;
     return true;
+#endif  // SD_MULTI_BLOCK_WRITE
 
 fail:
     CS1;
@@ -384,6 +533,43 @@ fail:
     return false;
 }
 
+// Write count sequential blocks.  The blocks continue the current
+// multiple block write if they follow the last block written, else a
+// new one is started with a pre-erase count of count blocks.
+uint8_t Sd2Card::writeBlocks(uint32_t blockNumber, uint32_t count, const uint8_t* src) {
+#if SD_MULTI_BLOCK_WRITE
+    if (!inWrite_ || blockNumber != writeNext_) {
+        if (!writeStart(blockNumber, count)) 
+            goto fail;
+        inWrite_ = 1;
+    }
+    for (uint32_t i = 0; i < count; i++, src += 512) {
+        if (!writeData(src)) {
+            // send stop token so the card leaves the CMD25 sequence
+            writeStop();
+            goto fail;
+        }
+    }
+    writeNext_ = blockNumber + count;
+    return true;
+#else  // SD_MULTI_BLOCK_WRITE
+    if (!writeStart(blockNumber, count)) 
+        goto fail;
+    for (uint32_t i = 0; i < count; i++, src += 512) {
+        if (!writeData(src)) {
+            writeStop();
+            goto fail;
+        }
+    }
+    return writeStop();
+#endif  // SD_MULTI_BLOCK_WRITE
+
+fail:
+    CS1;
+    SerialUSB.println("Error: Sd2Card::writeBlocks");
+    return false;
+}
+
 uint8_t Sd2Card::writeData(const uint8_t* src) {
     // wait for previous write to finish
     if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
@@ -428,6 +614,13 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
     return true;
 }
 
+// end a multiple block write started by writeBlock()
+uint8_t Sd2Card::writeEnd(void) {
+    if (!inWrite_) 
+        return true;
+    return writeStop();
+}
+
 uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
 #if SD_PROTECT_BLOCK_ZERO
     // don't allow write to first block
@@ -437,8 +630,8 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
         goto fail;
     }
 #endif  // SD_PROTECT_BLOCK_ZERO
-    // send pre-erase count
-    if (cardAcmd(ACMD23, eraseCount)) {
+    // send pre-erase count, zero for no pre-erase command
+    if (eraseCount && cardAcmd(ACMD23, eraseCount)) {
         SerialUSB.println("Error: ACMD23");
         error(SD_CARD_ERROR_ACMD23);
         goto fail;
@@ -460,6 +653,9 @@ fail:
 }
 
 uint8_t Sd2Card::writeStop(void) {
+    inWrite_ = 0;
+    // writeData() deselects the card on error, select it for the token
+    CS0;
     if (!waitNotBusy(SD_WRITE_TIMEOUT)) 
         goto fail;
     spiSend(STOP_TRAN_TOKEN);
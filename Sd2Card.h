@@ -17,6 +17,9 @@
 
 #define SD_PROTECT_BLOCK_ZERO 1 // Protect block zero from write if nonzero
 
+#define SD_MULTI_BLOCK_WRITE 1 // Combine writeBlock() calls for sequential blocks into one CMD25 if nonzero
+#define SD_MULTI_BLOCK_READ 1 // Stream reads of sequential blocks with one CMD18 if nonzero
+
 #define SPI_BUFF_SIZE 512
 
 uint16_t const SD_INIT_TIMEOUT = 2000; // init timeout ms
@@ -47,6 +50,8 @@ uint8_t const SD_CARD_ERROR_WRITE_MULTIPLE = 0X13; // multiple block write not a
 uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14; // error to CMD13
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15; // write programming timeout
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16; // incorrect rate selected
+uint8_t const SD_CARD_ERROR_CMD12 = 0X17; // error to CMD12 (stop transmission)
+uint8_t const SD_CARD_ERROR_CMD18 = 0X18; // error to CMD18 (read multiple blocks)
 
 uint8_t const SD_CARD_TYPE_SD1 = 1;
 uint8_t const SD_CARD_TYPE_SD2 = 2;
@@ -66,6 +71,7 @@ class Sd2Card : public HardwareSPI {
         void partialBlockRead(uint8_t value);
         uint8_t partialBlockRead(void) const {return partialBlockRead_;}
         uint8_t readBlock(uint32_t block, uint8_t* dst);
+        uint8_t readBlocks(uint32_t blockNumber, uint32_t count, uint8_t* dst);
         uint8_t readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t* dst);
         uint8_t readCID(cid_t* cid) {
             return readRegister(CMD10, cid);
@@ -73,10 +79,15 @@ class Sd2Card : public HardwareSPI {
         uint8_t readCSD(csd_t* csd) {
             return readRegister(CMD9, csd);
         }
+        uint8_t readData(uint8_t* dst);
         void readEnd(void);
+        uint8_t readStart(uint32_t blockNumber);
+        uint8_t readStop(void);
         uint8_t type(void) const {return type_;}
         uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
+        uint8_t writeBlocks(uint32_t blockNumber, uint32_t count, const uint8_t* src);
         uint8_t writeData(const uint8_t* src);
+        uint8_t writeEnd(void);
         uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
         uint8_t writeStop(void);
  
@@ -89,6 +100,10 @@ class Sd2Card : public HardwareSPI {
         uint8_t partialBlockRead_;
         uint8_t status_;
         uint8_t type_;
+        uint8_t inWrite_;
+        uint32_t writeNext_;
+        uint8_t inRead_;
+        uint32_t readNext_;
         //pol
         uint8_t ack[SPI_BUFF_SIZE];
         // private functions
@@ -100,6 +115,7 @@ class Sd2Card : public HardwareSPI {
         void error(uint8_t code) {errorCode_ = code;}
         uint8_t readRegister(uint8_t cmd, void* buf);
         uint8_t sendWriteCommand(uint32_t blockNumber, uint32_t eraseCount);
+        void spiRead(uint8_t* dst, uint16_t count);
         void type(uint8_t value) {type_ = value;}
         uint8_t waitNotBusy(uint16_t timeoutMillis);
         uint8_t writeData(uint8_t token, const uint8_t* src);
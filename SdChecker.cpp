@@ -0,0 +1,272 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "SdFat.h"
+
+//------------------------------------------------------------------------------
+/**
+ * Start a check of a volume.
+ *
+ * Reclaim of lost clusters is only safe if no file on the volume has
+ * been extended since it was last synced.  Clusters added to a file
+ * are not in the directory tree until sync() writes the file's
+ * directory entry.
+ *
+ * \param[in] vol The FAT16 or FAT32 volume to check.
+ *
+ * \param[in] bitmap Buffer for one bit per cluster.  Any size works but
+ * the directory tree is walked once for each \a size * 8 clusters.
+ *
+ * \param[in] size Size of \a bitmap in bytes.
+ *
+ * \param[in] reclaim Free lost clusters if true.  Lost clusters are not
+ * freed if a directory could not be checked.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  Reasons for
+ * failure include the volume is not initialized, the volume is exFAT,
+ * \a size is zero or an I/O error.
+ */
+uint8_t SdChecker::begin(SdVolume* vol, uint8_t* bitmap, uint16_t size, uint8_t reclaim) {
+    vol_ = 0;
+    if (size == 0 || (vol->fatType() != 16 && vol->fatType() != 32)) 
+        return false;
+    vol_ = vol;
+    bitmap_ = bitmap;
+    winSize_ = 8UL * size;
+    winStart_ = 2;
+    reclaim_ = reclaim;
+    badChains_ = 0;
+    crossLinks_ = 0;
+    dirCount_ = 0;
+    fileCount_ = 0;
+    lostClusters_ = 0;
+    reclaimed_ = 0;
+    sizeErrors_ = 0;
+    skippedDirs_ = 0;
+    if (!treeBegin()) 
+        vol_ = 0;
+    return vol_ != 0;
+}
+//------------------------------------------------------------------------------
+// start the walk of the chain at cluster for a file with size bytes
+// or a directory
+uint8_t SdChecker::chainBegin(uint32_t cluster, uint32_t size, uint8_t isDir) {
+    uint8_t shift = vol_->clusterSizeShift() + 9;
+    chainExpect_ = isDir ? 0XFFFFFFFF
+        : (size >> shift) + ((size & ((1UL << shift) - 1)) != 0);
+    chainLinks_ = 0;
+    chainNext_ = cluster;
+    chainOk_ = cluster != 0;
+
+    // a file with data must have a chain
+    if (cluster == 0 && chainExpect_ && !isDir && winStart_ == 2) 
+        sizeErrors_++;
+    return true;
+}
+//------------------------------------------------------------------------------
+// follow the current chain for the links in one FAT block
+uint8_t SdChecker::chainStep(void) {
+    uint8_t fat16 = vol_->fat16();
+    uint8_t shift = vol_->fatEntryShift_;
+    uint32_t fatBlock = chainNext_ >> shift;
+    uint32_t winEnd = winStart_ + winSize_;
+
+    // problems with the chain are counted on the first window only
+    uint8_t count = winStart_ == 2;
+
+    for (uint16_t n = 0; n < 256 && (chainNext_ >> shift) == fatBlock; n++) {
+        uint32_t c = chainNext_;
+        uint32_t next;
+        // error if not in FAT
+        if (c < 2 || c > (vol_->clusterCount_ + 1)) 
+            goto badChain;
+
+        // more links than clusters is a loop
+        if (++chainLinks_ > vol_->clusterCount_) 
+            goto badChain;
+
+        if (c >= winStart_ && c < winEnd) {
+            uint8_t* p = bitmap_ + ((c - winStart_) >> 3);
+            uint8_t m = 1 << ((c - winStart_) & 7);
+            if (*p & m) 
+                crossLinks_++;
+            *p |= m;
+        }
+        if (!vol_->fatGet(c, &next)) 
+            return false;
+        if (vol_->isEOC(next)) {
+            if (count && chainExpect_ != 0XFFFFFFFF && chainLinks_ != chainExpect_) 
+                sizeErrors_++;
+            chainNext_ = 0;
+            break;
+        }
+        // error if link to a free, reserved or bad cluster
+        if (next < 2 || next == (fat16 ? FAT16BAD : FAT32BAD)) 
+            goto badChain;
+        chainNext_ = next;
+    }
+    return true;
+
+ badChain:
+    if (count) 
+        badChains_++;
+    chainNext_ = 0;
+    chainOk_ = false;
+    return true;
+}
+//------------------------------------------------------------------------------
+// compare the FAT entries in one FAT block with the window bitmap
+uint8_t SdChecker::fatStep(void) {
+    uint8_t shift = vol_->fatEntryShift_;
+    uint32_t end = vol_->clusterCount_ + 2;
+    if ((end - winStart_) > winSize_) 
+        end = winStart_ + winSize_;
+
+    uint32_t c = fatNext_;
+    do {
+        uint32_t v;
+        if (!vol_->fatGet(c, &v)) 
+            return false;
+        uint8_t used = bitmap_[(c - winStart_) >> 3] & (1 << ((c - winStart_) & 7));
+        if (v != 0 && v != (vol_->fat16() ? FAT16BAD : FAT32BAD) && !used) {
+            lostClusters_++;
+            if (reclaim_) {
+                if (!vol_->fatPut(c, 0)) 
+                    return false;
+                // keep search start at or before first free cluster
+                if (c < vol_->allocSearchStart_) 
+                    vol_->allocSearchStart_ = c;
+                reclaimed_++;
+            }
+        }
+        c++;
+    } while (c < end && (c & ((1 << shift) - 1)));
+    fatNext_ = c;
+
+    if (c < end) 
+        return true;
+
+    // next window
+    winStart_ = end;
+    if (winStart_ >= (vol_->clusterCount_ + 2)) {
+        state_ = STATE_DONE;
+        return true;
+    }
+    return treeBegin();
+}
+//------------------------------------------------------------------------------
+/**
+ * Continue a check started by begin().
+ *
+ * Each call does at least one step of the check, a step reads at most
+ * one FAT or directory block.  Results are available from badChains(),
+ * crossLinks(), lostClusters() and the other counts when step() returns one.
+ *
+ * The volume may change between calls.  Files and directories that are
+ * modified while the check runs may be reported as problems.
+ *
+ * \param[in] millisBudget Return when more than this many milliseconds
+ * have passed.  Zero runs the check to completion in one call.
+ *
+ * \return One if the check is complete, zero if more steps are required
+ * or -1 if an error occurs.  Call begin() to restart after an error.
+ */
+int8_t SdChecker::step(uint16_t millisBudget) {
+    if (!vol_) 
+        return -1;
+    uint32_t t0 = millisBudget ? millis() : 0;
+    while (state_ != STATE_DONE) {
+        if (!(state_ == STATE_TREE ? treeStep() : fatStep())) {
+            vol_ = 0;
+            return -1;
+        }
+        if (millisBudget && (millis() - t0) >= millisBudget) 
+            break;
+    }
+    return state_ == STATE_DONE;
+}
+//------------------------------------------------------------------------------
+// clear the bitmap and start a walk of the directory tree at root
+uint8_t SdChecker::treeBegin(void) {
+    for (uint32_t i = 0; i < winSize_/8; i++) 
+        bitmap_[i] = 0;
+    for (uint8_t i = 0; i <= MAX_DEPTH; i++) 
+        dir_[i].close();
+    depth_ = 0;
+    subDirPending_ = false;
+    state_ = STATE_TREE;
+    fatNext_ = winStart_;
+    if (!dir_[0].openRoot(vol_)) 
+        return false;
+    // FAT32 root is a chain with no directory entry
+    return chainBegin(dir_[0].firstCluster(), 0, true);
+}
+//------------------------------------------------------------------------------
+// walk a chain, open a subdirectory or check the next directory entry
+uint8_t SdChecker::treeStep(void) {
+    SdFile* dir = &dir_[depth_];
+
+    if (chainNext_) 
+        return chainStep();
+
+    // only count problems on the first window
+    uint8_t count = winStart_ == 2;
+
+    if (subDirPending_) {
+        subDirPending_ = false;
+        // don't open a directory with a bad chain, its size is unknown
+        if (chainOk_ && depth_ < MAX_DEPTH && dir_[depth_ + 1].open(dir, subDirIndex_, O_READ)) {
+            depth_++;
+        } else {
+            if (count) 
+                skippedDirs_++;
+            // files in a skipped directory would look lost
+            reclaim_ = false;
+        }
+        // open moves the position in dir
+        return dir->seekSet(32UL * (subDirIndex_ + 1));
+    }
+    dir_t d;
+    int8_t n = dir->readDir(&d);
+    if (n <= 0) {
+        if (n < 0) {
+            if (count) 
+                skippedDirs_++;
+            reclaim_ = false;
+        }
+        dir->close();
+        if (depth_ == 0) 
+            state_ = STATE_FAT;
+        else 
+            depth_--;
+        return true;
+    }
+    uint32_t cluster = (uint32_t)d.firstClusterHigh << 16 | d.firstClusterLow;
+    if (DIR_IS_SUBDIR(&d)) {
+        if (count) 
+            dirCount_++;
+        subDirIndex_ = dir->curPosition()/32 - 1;
+        subDirPending_ = true;
+        return chainBegin(cluster, 0, true);
+    }
+    if (count) 
+        fileCount_++;
+    return chainBegin(cluster, d.fileSize, false);
+}
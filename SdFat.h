@@ -11,6 +11,22 @@
  */
 #define ALLOW_DEPRECATED_FUNCTIONS 0
 //------------------------------------------------------------------------------
+/**
+ * Support FAT16 volumes if non-zero.  Set FAT16_SUPPORT or FAT32_SUPPORT
+ * to zero to remove the FAT type test from FAT access functions.
+ */
+#define FAT16_SUPPORT 1
+/** Support FAT32 volumes if non-zero. */
+#define FAT32_SUPPORT 1
+//------------------------------------------------------------------------------
+/**
+ * Number of files whose end of file cluster is remembered by SdVolume when
+ * the file is synced or closed.  Reopening one of these files and seeking
+ * to its end follows the FAT chain from that cluster instead of from the
+ * first cluster.  Set to zero to save RAM.
+ */
+#define END_CLUSTER_CACHE_SIZE 4
+//------------------------------------------------------------------------------
 // forward declaration since SdVolume is used in SdFile
 class SdVolume;
 //==============================================================================
@@ -46,6 +62,30 @@ uint8_t const O_CREAT = 0X10;
 uint8_t const O_EXCL = 0X20;
 /** truncate the file to zero length */
 uint8_t const O_TRUNC = 0X40;
+/** file data bypasses the cache, offsets and lengths must be block aligned */
+uint8_t const O_DIRECT = 0X80;
+
+// values for allocation policy
+/** SdFile uses the allocation policy of its SdVolume */
+uint8_t const ALLOC_DEFAULT = 0;
+/** First free clusters found searching from the start of the FAT */
+uint8_t const ALLOC_FIRST_FIT = 1;
+/** First free clusters found after the last allocation on the volume */
+uint8_t const ALLOC_NEXT_FIT = 2;
+/** Smallest free run of clusters that holds the requested size */
+uint8_t const ALLOC_BEST_FIT = 3;
+/** New runs of clusters start on an allocation unit boundary */
+uint8_t const ALLOC_AU_ALIGNED = 4;
+
+// values for SdFile::advise()
+/** Default cache use, whole blocks bypass the cache */
+uint8_t const ADVISE_NORMAL = 0;
+/** File is read in order, accepted for compatibility, same as ADVISE_NORMAL */
+uint8_t const ADVISE_SEQUENTIAL = 1;
+/** File blocks are reused, whole block reads are kept in the cache */
+uint8_t const ADVISE_RANDOM = 2;
+/** File data is used once, reads never replace the block in the cache */
+uint8_t const ADVISE_NOREUSE = 3;
 
 // flags for timestamp
 /** set the file's last access date */
@@ -67,6 +107,12 @@ uint8_t const FAT_FILE_TYPE_ROOT32 = 3;
 uint8_t const FAT_FILE_TYPE_SUBDIR = 4;
 /** Test value for directory type */
 uint8_t const FAT_FILE_TYPE_MIN_DIR = FAT_FILE_TYPE_ROOT16;
+/** SdVolume::fatType() value for an exFAT volume */
+uint8_t const FAT_TYPE_EXFAT = 64;
+/** Longest exFAT file name, an entry set for this name fits in two blocks */
+uint8_t const EXFAT_NAME_MAX = 225;
+/** Longest FAT16 or FAT32 long file name */
+uint8_t const LFN_NAME_MAX = 255;
 
 /** date field for FAT directory entry */
 static inline uint16_t FAT_DATE(uint16_t year, uint8_t month, uint8_t day) {
@@ -105,17 +151,62 @@ uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 //------------------------------------------------------------------------------
+/**
+ * \struct fatExtent
+ * \brief A run of contiguous clusters in a file's cluster chain.
+ */
+struct fatExtent {
+    /** Index of the first cluster of the run in the file, zero based. */
+    uint32_t fileCluster;
+    /** Volume cluster number for the first cluster of the run. */
+    uint32_t diskCluster;
+    /** Number of clusters in the run. */
+    uint32_t length;
+};
+/** Type name for fatExtent */
+typedef struct fatExtent extent_t;
+//------------------------------------------------------------------------------
 
 class SdFile : public Print {
     public:
         /** Create an instance of SdFile. */
-        SdFile(void) : type_(FAT_FILE_TYPE_CLOSED) {}
+        SdFile(void) : type_(FAT_FILE_TYPE_CLOSED), allocPolicy_(ALLOC_DEFAULT),
+            advice_(ADVISE_NORMAL), compactRead_(0), compactTail_(false), extent_(0), nameIndex_(0), wbuf_(0), wbufCount_(0) {}
         /**
          * writeError is set to true if an error occurs during a write().
          * Set writeError to false before calling print() and/or write() and check
          * for true after calls to print() and/or write().
          */
         bool writeError;
+        /** \return The cache advice for this file. */
+        uint8_t advice(void) const {return advice_;}
+        /**
+         * Tell the cache how this file will be accessed.
+         * The advice is kept when the file is closed and reopened.
+         *
+         * With ADVISE_NOREUSE and Sd2Card::partialBlockRead() enabled,
+         * reads of partial blocks go directly to the card so the FAT or
+         * directory block in the cache is kept for the next allocation or
+         * sync().  Without partial block reads each small read would read
+         * a whole block, so partial blocks are read through the cache.
+         * Whole blocks never replace the cached block.
+         *
+         * ADVISE_SEQUENTIAL is a no-op, reads in order already bypass the
+         * cache for whole blocks with ADVISE_NORMAL.
+         *
+         * \param[in] advice One of the ADVISE_ values.
+         */
+        void advise(uint8_t advice) {advice_ = advice;}
+        /** \return The allocation policy for this file. */
+        uint8_t allocPolicy(void) const {return allocPolicy_;}
+        /**
+         * Set the allocation policy for clusters added to this file.
+         * The policy is kept when the file is closed and reopened.
+         *
+         * \param[in] policy One of the ALLOC_ values.  ALLOC_DEFAULT uses
+         * the policy of the file's volume.
+         */
+        void allocPolicy(uint8_t policy) {allocPolicy_ = policy;}
         /**
          * Cancel unbuffered reads for this file.
          * See setUnbufferedRead()
@@ -123,7 +214,27 @@ class SdFile : public Print {
         void clearUnbufferedRead(void) {
             flags_ &= ~F_FILE_UNBUFFERED_READ;
         }
+        /**
+         * Stop using an extent cache for this file.
+         * See setExtentCache()
+         */
+        void clearExtentCache(void) {
+            extent_ = 0;
+        }
+        /**
+         * Stop using a name index for this directory.
+         * See setNameIndex()
+         */
+        void clearNameIndex(void) {
+            nameIndex_ = 0;
+        }
+        /**
+         * Flush and stop using a write buffer for this file.
+         * See setWriteBuffer()
+         */
+        uint8_t clearWriteBuffer(void) {return setWriteBuffer(0, 0);}
         uint8_t close(void);
+        int8_t compactDir(uint16_t count);
         uint8_t contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
         uint8_t createContiguous(SdFile* dirFile, const char* fileName, uint32_t size);
         /** \return The current cluster number for a file or directory. */
@@ -174,10 +285,16 @@ class SdFile : public Print {
         /** \return Index of this file's directory in the block dirBlock. */
         uint8_t dirIndex(void) const {return dirIndex_;}
         static void dirName(const dir_t& dir, char* name);
+        /** \return The number of extents in the extent cache. */
+        uint8_t extentCount(void) const {return extent_ ? extentCount_ : 0;}
         /** \return The total number of bytes in a file or directory. */
-        uint32_t fileSize(void) const {return fileSize_;}
+        uint32_t fileSize(void) const {
+            return curPosition_ > fileSize_ ? curPosition_ : fileSize_;
+        }
         /** \return The first cluster number for a file or directory. */
         uint32_t firstCluster(void) const {return firstCluster_;}
+        uint8_t getName(char* name, uint16_t size);
+        uint8_t fragmentCount(uint32_t* count);
         /** \return True if this is a SdFile for a directory else false. */
         uint8_t isDir(void) const {return type_ >= FAT_FILE_TYPE_MIN_DIR;}
         /** \return True if this is a SdFile for a file else false. */
@@ -199,6 +316,17 @@ class SdFile : public Print {
         static void printDirName(const dir_t& dir, uint8_t width);
         static void printFatDate(uint16_t fatDate);
         static void printFatTime(uint16_t fatTime);
+        int16_t printField(double value, char term, uint8_t prec = 2);
+        int16_t printField(long value, char term);
+        int16_t printField(unsigned long value, char term);
+        /** Write an int and a field terminator.  See printField(long, char). */
+        int16_t printField(int value, char term) {
+            return printField((long)value, term);
+        }
+        /** Write an unsigned int and a field terminator.  See printField(long, char). */
+        int16_t printField(unsigned int value, char term) {
+            return printField((unsigned long)value, term);
+        }
         static void printTwoDigits(uint8_t v);
         /**
          * Read the next byte from a file.
@@ -211,11 +339,19 @@ class SdFile : public Print {
             return read(&b, 1) == 1 ? b : -1;
         }
         int16_t read(void* buf, uint16_t nbyte);
-        int8_t readDir(dir_t* dir);
+        int32_t read32(void* buf, size_t nbyte);
+        int8_t readDir(dir_t* dir, char* longName = 0, uint16_t size = 0);
         static uint8_t remove(SdFile* dirFile, const char* fileName);
         uint8_t remove(void);
-        /** Set the file's current position to zero. */
+        /**
+         * Set the file's current position to zero.  If buffered data
+         * can't be written, writeError is set and the position is kept.
+         */
         void rewind(void) {
+            if (!writeFlush()) {
+                writeError = true;
+                return;
+            }
             curPosition_ = curCluster_ = 0;
         }
         uint8_t rmDir(void);
@@ -228,8 +364,10 @@ class SdFile : public Print {
           *  Set the files current position to end of file.  Useful to position
           *  a file for append. See seekSet().
           */
-        uint8_t seekEnd(void) {return seekSet(fileSize_);}
+        uint8_t seekEnd(void) {return seekSet(fileSize());}
         uint8_t seekSet(uint32_t pos);
+        void setExtentCache(extent_t* cache, uint8_t size);
+        uint8_t setNameIndex(uint16_t* index, uint16_t size);
         /**
          * Use unbuffered reads to access this file.  Used with Wave
          * Shield ISR.  Used with Sd2Card::partialBlockRead() in WaveRP.
@@ -239,6 +377,7 @@ class SdFile : public Print {
         void setUnbufferedRead(void) {
             if (isFile()) flags_ |= F_FILE_UNBUFFERED_READ;
         }
+        uint8_t setWriteBuffer(uint8_t* buf, uint8_t blocks);
         uint8_t timestamp(uint8_t flag, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
         uint8_t sync(void);
         /** Type of this SdFile.  You should use isFile() or isDir() instead of type()
@@ -257,6 +396,7 @@ class SdFile : public Print {
         void write(uint8_t b);
         int16_t write(const void* buf, uint16_t nbyte);
         void write(const char* str);
+        int32_t write32(const void* buf, size_t nbyte);
         //  void write_P(PGM_P str);
         //  void writeln_P(PGM_P str);
 //------------------------------------------------------------------------------
@@ -334,37 +474,84 @@ class SdFile : public Print {
         // bits defined in flags_
         // should be 0XF
         static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
-        // available bits
-        static uint8_t const F_UNUSED = 0X30;
+        // file opened with O_DIRECT
+        static uint8_t const F_FILE_DIRECT = 0X20;
+        // exFAT file with contiguous clusters and no FAT chain
+        static uint8_t const F_FILE_CONTIGUOUS = 0X10;
         // use unbuffered SD read
         static uint8_t const F_FILE_UNBUFFERED_READ = 0X40;
         // sync of directory entry required
         static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
         // make sure F_OFLAG is ok
-        #if ((F_UNUSED | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
+        #if ((F_FILE_DIRECT | F_FILE_CONTIGUOUS | F_FILE_UNBUFFERED_READ | F_FILE_DIR_DIRTY) & F_OFLAG)
         #error flags_ bits conflict
         #endif  // flags_ bits
 
         // private data
         uint8_t   flags_;         // See above for definition of flags_ bits
         uint8_t   type_;          // type of file see above for values
+        uint8_t   allocPolicy_;   // allocation policy for new clusters
+        uint8_t   advice_;        // expected access pattern for the cache
+        uint32_t  compactRead_;   // next entry for compactDir(), zero if not started
+        uint32_t  compactWrite_;  // entries before this one are compacted
+        uint8_t   compactTail_;   // all entries moved, compactRead_ ends the search
         uint32_t  curCluster_;    // cluster for current file position
         uint32_t  curPosition_;   // current file position in bytes from beginning
         uint32_t  dirBlock_;      // SD block that contains directory entry for file
         uint8_t   dirIndex_;      // index of entry in dirBlock 0 <= dirIndex_ <= 0XF
+        uint32_t  dirNextBlock_;  // block with the rest of an exFAT entry set
+        uint32_t  endCluster_;    // cluster at endIndex_ in chain, zero if unknown
+        uint32_t  endIndex_;      // cluster index of endCluster_
+        uint8_t   dirCount_;      // number of entries in an exFAT entry set
         uint32_t  fileSize_;      // file size in bytes
         uint32_t  firstCluster_;  // first cluster of file
+        uint32_t  lfnBlock_;      // block with the first long name entry
+        uint8_t   lfnIndex_;      // index of the first long name entry in lfnBlock_
+        uint8_t   lfnCount_;      // number of long name entries, zero if none
         SdVolume* vol_;           // volume where file is located
+        extent_t* extent_;        // optional cache of cluster runs, may be null
+        uint8_t   extentMax_;     // number of entries in extent_
+        uint8_t   extentCount_;   // number of extents in use
+        uint16_t* nameIndex_;     // optional name hash of each dir entry, may be null
+        uint16_t  nameIndexMax_;  // number of entries in nameIndex_
+        uint16_t  nameIndexCount_;  // entries indexed, zero until index is built
+        uint8_t*  wbuf_;          // optional write buffer, may be null
+        uint8_t   wbufBlocks_;    // size of wbuf_ in blocks
+        uint32_t  wbufPos_;       // file position of the first byte in wbuf_
+        uint32_t  wbufCount_;     // number of bytes in wbuf_
 
         // private functions
         uint8_t addCluster(void);
         uint8_t addDirCluster(void);
         dir_t* cacheDirEntry(uint8_t action);
+        dir_t* cacheSetEntry(uint8_t i, uint8_t action);
         static void (*dateTime_)(uint16_t* date, uint16_t* time);
+        static void dirEntryInit(dir_t* p, const uint8_t* name);
+        uint8_t extentGet(uint32_t index, uint32_t* cluster) const;
+        void extentPut(uint32_t index, uint32_t cluster);
+        void extentTrim(uint32_t count);
+        uint8_t lfnFind(SdFile* dirFile, uint32_t slot);
+        uint8_t lfnNext(uint32_t* block, uint8_t* index);
+        static uint8_t lfnInSet(const dir_t* p, uint8_t sum, uint8_t ord);
         static uint8_t make83Name(const char* str, uint8_t* name);
+        static uint8_t makeExFatName(const char* str, uint8_t* length, uint16_t* hash);
+        static uint16_t nameHash(const uint8_t* name);
+        uint8_t nameIndexBuild(void);
+        void nameIndexGrow(uint32_t slot);
+        void nameIndexPut(uint32_t slot, uint16_t hash);
+        uint8_t nextCluster(uint32_t cluster, uint32_t* next);
         uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
+        uint8_t openCachedSet(uint8_t oflags);
+        uint8_t openExFat(SdFile* dirFile, const char* fileName, uint8_t oflag);
+        uint8_t openLfn(SdFile* dirFile, const char* fileName, uint8_t oflag);
         dir_t* readDirCache(void);
+        uint8_t readRun(uint8_t* dst, uint32_t want, uint32_t* count);
+        uint8_t syncSet(void);
+        uint8_t writeBuffer(const uint8_t* src, uint32_t nbyte);
+        uint8_t writeBytes(const uint8_t* src, uint32_t nbyte);
+        uint8_t writeFlush(void);
+        uint8_t writeRun(const uint8_t* src, uint32_t want, uint32_t* count);
 };
 
 union cache_t {
@@ -380,16 +567,21 @@ union cache_t {
     mbr_t    mbr;
     /** Used to access to a cached FAT boot sector. */
     fbs_t    fbs;
+    /** Used to access to a cached exFAT boot sector. */
+    xbs_t    xbs;
 };
 
 class SdVolume {
     public:
         /** Create an instance of SdVolume */
-        SdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+        SdVolume(void) :cacheBlockNumber_(0XFFFFFFFF), sdCard_(0), cacheDirty_(0), cacheMirrorBlock_(0),
+            allocPolicy_(ALLOC_FIRST_FIT), allocRover_(2), allocSearchStart_(2),
+            allocUnitBlocks_(8192), fatEntryShift_(7), fatEOCMin_(FAT32EOC_MIN), fatType_(0), freeScanBlock_(0), freeScanCount_(0),
+            volumeDirty_(0), volumeIdValid_(0), wasClean_(0) {}
         /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
          *  recorder to do raw write to the SD card.  Not for normal apps.
          */
-        static uint8_t* cacheClear(void) {
+        uint8_t* cacheClear(void) {
             cacheFlush();
             cacheBlockNumber_ = 0XFFFFFFFF;
             return cacheBuffer_.data;
@@ -407,10 +599,32 @@ class SdVolume {
          */
         uint8_t init(Sd2Card* dev) { return init(dev, 1) ? true : init(dev, 0);}
         uint8_t init(Sd2Card* dev, uint8_t part);
+        uint8_t remount(Sd2Card* dev);
         
+        /** \return The default allocation policy for files on the volume. */
+        uint8_t allocPolicy(void) const {return allocPolicy_;}
+        /**
+         * Set the default allocation policy for files on the volume.
+         *
+         * \param[in] policy One of ALLOC_FIRST_FIT, ALLOC_NEXT_FIT,
+         * ALLOC_BEST_FIT or ALLOC_AU_ALIGNED.
+         */
+        void allocPolicy(uint8_t policy) {
+            allocPolicy_ = policy == ALLOC_DEFAULT ? ALLOC_FIRST_FIT : policy;
+        }
+        /** \return The allocation unit size in blocks used by ALLOC_AU_ALIGNED. */
+        uint32_t allocUnitSize(void) const {return allocUnitBlocks_;}
+        /**
+         * Set the allocation unit size used by ALLOC_AU_ALIGNED.
+         * The default is 8192 blocks, a 4 MB allocation unit.
+         *
+         * \param[in] blocks Allocation unit size in blocks.  Must be
+         * a multiple of the cluster size.
+         */
+        void allocUnitSize(uint32_t blocks) {allocUnitBlocks_ = blocks;}
         // inline functions that return volume info
         /** \return The volume's cluster size in blocks. */
-        uint8_t blocksPerCluster(void) const {return blocksPerCluster_;}
+        uint16_t blocksPerCluster(void) const {return blocksPerCluster_;}
         /** \return The number of blocks in one FAT. */
         uint32_t blocksPerFat(void)  const {return blocksPerFat_;}
         /** \return The total number of clusters in the volume. */
@@ -423,41 +637,92 @@ class SdVolume {
         uint8_t fatCount(void) const {return fatCount_;}
         /** \return The logical block number for the start of the first FAT. */
         uint32_t fatStartBlock(void) const {return fatStartBlock_;}
-        /** \return The FAT type of the volume. Values are 12, 16 or 32. */
+        /** \return The FAT type of the volume. Values are 16, 32 or FAT_TYPE_EXFAT. */
         uint8_t fatType(void) const {return fatType_;}
+        int32_t freeClusterCount(void);
+        /**
+         * Restart the incremental free cluster count.
+         * See freeClusterCountStep().
+         */
+        void freeClusterCountBegin(void) {
+            freeScanBlock_ = 0;
+            freeScanCount_ = 0;
+        }
+        int8_t freeClusterCountStep(uint32_t blockCount, uint32_t* count);
+        int32_t freeRunCount(uint32_t* hist = 0, uint8_t bins = 0, uint32_t* largest = 0);
+        uint8_t markClean(void);
         /** \return The number of entries in the root directory for FAT16 volumes. */
         uint32_t rootDirEntryCount(void) const {return rootDirEntryCount_;}
         /** \return The logical block number for the start of the root directory
          on FAT16 volumes or the first cluster number on FAT32 volumes. */
         uint32_t rootDirStart(void) const {return rootDirStart_;}
         /** return a pointer to the Sd2Card object for this volume */
-        static Sd2Card* sdCard(void) {return sdCard_;}
+        Sd2Card* sdCard(void) const {return sdCard_;}
+        /**
+         * \return true if the volume was marked clean when it was mounted
+         * by init(), false if the last session did not end with markClean().
+         */
+        uint8_t wasClean(void) const {return wasClean_;}
     private:
-        // Allow SdFile access to SdVolume private data.
+        // Allow SdFile and SdChecker access to SdVolume private data.
         friend class SdFile;
+        friend class SdChecker;
         // value for action argument in cacheRawBlock to indicate read from cache
         static uint8_t const CACHE_FOR_READ = 0;
         // value for action argument in cacheRawBlock to indicate cache dirty
         static uint8_t const CACHE_FOR_WRITE = 1;
-        static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-        static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
-        static Sd2Card* sdCard_;            // Sd2Card object for cache
-        static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-        static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+        cache_t cacheBuffer_;         // 512 byte cache for device blocks
+        uint32_t cacheBlockNumber_;   // Logical number of block in the cache
+        Sd2Card* sdCard_;             // Sd2Card object for cache
+        uint8_t cacheDirty_;          // cacheFlush() will write block if true
+        uint32_t cacheMirrorBlock_;   // block number for mirror FAT
         
+        uint8_t allocPolicy_;         // default allocation policy for files
+        uint32_t allocRover_;         // cluster after last allocation for next fit
         uint32_t allocSearchStart_;   // start cluster for alloc search
-        uint8_t blocksPerCluster_;    // cluster size in blocks
+        uint32_t allocUnitBlocks_;    // allocation unit size for AU aligned policy
+        uint32_t bitmapStartBlock_;   // first block of exFAT allocation bitmap
+        uint16_t blocksPerCluster_;   // cluster size in blocks
         uint32_t blocksPerFat_;       // FAT size in blocks
+        uint32_t cardSerial_;         // CID serial number of the card for remount
         uint32_t clusterCount_;       // clusters in one FAT
         uint8_t clusterSizeShift_;    // shift to convert cluster count to block count
         uint32_t dataStartBlock_;     // first data block number
+#if END_CLUSTER_CACHE_SIZE
+        struct endCluster_t {
+            uint32_t dirBlock;        // block with the file's directory entry
+            uint8_t dirIndex;         // index of the entry in dirBlock
+            uint32_t firstCluster;    // first cluster of file, zero if unused
+            uint32_t index;           // index of cluster in the file's chain
+            uint32_t cluster;         // cluster number
+        };
+        endCluster_t endCache_[END_CLUSTER_CACHE_SIZE];  // see endClusterPut()
+        uint8_t endCacheNext_;        // next entry of endCache_ to replace
+#endif  // END_CLUSTER_CACHE_SIZE
         uint8_t fatCount_;            // number of FATs on volume
+        uint8_t fatEntryShift_;       // shift to convert cluster to FAT block offset
+        uint32_t fatEOCMin_;          // minimum EOC value for the FAT type
         uint32_t fatStartBlock_;      // start block for first FAT
         uint8_t fatType_;             // volume type (12, 16, OR 32)
+        uint32_t freeScanBlock_;      // next FAT block for free cluster count
+        uint32_t freeScanCount_;      // free clusters found in scanned FAT blocks
         uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
         uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
+        uint8_t volumeDirty_;         // volume is marked dirty on the card
+        uint8_t volumeIdValid_;       // cardSerial_ and volumeSerial_ were read
+        uint32_t volumeSerial_;       // boot sector serial number for remount
+        uint32_t volumeStartBlock_;   // block number of the boot sector
+        uint8_t wasClean_;            // volume was marked clean at init()
         //----------------------------------------------------------------------------
-        uint8_t allocContiguous(uint32_t count, uint32_t* curCluster);
+        uint32_t allocAlign(uint32_t cluster) const;
+        uint8_t allocBestFit(uint32_t count, uint32_t* bgnCluster);
+        uint8_t allocContiguous(uint32_t count, uint32_t* curCluster,
+                                uint8_t policy = ALLOC_DEFAULT);
+        uint8_t allocFind(uint32_t count, uint32_t start, uint8_t align,
+                          uint32_t* bgnCluster);
+        uint8_t allocGet(uint32_t cluster, uint32_t* value);
+        uint16_t bitmapCountFree(uint16_t end) const;
+        uint8_t bitmapPut(uint32_t cluster, uint32_t count, uint8_t value);
         uint8_t blockOfCluster(uint32_t position) const {
             return (position >> 9) & (blocksPerCluster_ - 1);
         }
@@ -467,29 +732,136 @@ class SdVolume {
         uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
             return clusterStartBlock(cluster) + blockOfCluster(position);
         }
-        static uint8_t cacheFlush(void);
-        static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-        static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
-        static uint8_t cacheZeroBlock(uint32_t blockNumber);
-        uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
-        uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
+        uint8_t cacheFlush(void);
+        uint8_t cacheSync(void) {
+            return cacheFlush() && sdCard_->writeEnd();
+        }
+        uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
+        void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+        uint8_t cacheZeroBlock(uint32_t blockNumber);
+        uint8_t chainSize(uint32_t beginCluster, uint32_t* size);
+        void endClusterClear(void);
+        uint8_t endClusterGet(uint32_t dirBlock, uint8_t dirIndex,
+            uint32_t firstCluster, uint32_t* index, uint32_t* cluster) const;
+        void endClusterPut(uint32_t dirBlock, uint8_t dirIndex,
+            uint32_t firstCluster, uint32_t index, uint32_t cluster);
+        uint8_t fat16(void) const {
+#if FAT16_SUPPORT && FAT32_SUPPORT
+            return fatType_ == 16;
+#else  // FAT16_SUPPORT && FAT32_SUPPORT
+            return FAT16_SUPPORT;
+#endif  // FAT16_SUPPORT && FAT32_SUPPORT
+        }
+        uint16_t fatCountFree(uint16_t bgn, uint16_t end) const;
+        uint8_t fatFollow(uint32_t* cluster, uint32_t* count, uint8_t action);
+        uint8_t fatGet(uint32_t cluster, uint32_t* value);
         uint8_t fatPut(uint32_t cluster, uint32_t value);
+        uint8_t fatPutRun(uint32_t cluster, uint32_t count);
         uint8_t fatPutEOC(uint32_t cluster) {
-            return fatPut(cluster, 0x0FFFFFFF);
+            return fatPut(cluster, fatType_ == FAT_TYPE_EXFAT ? EXFAT_EOC : 0x0FFFFFFF);
         }
+        template <typename entry_t>
+        uint8_t fatWalk(uint32_t* cluster, uint32_t* count, uint8_t action);
         uint8_t freeChain(uint32_t cluster);
-        uint8_t isEOC(uint32_t cluster) const {
-            return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
-        }
+        uint8_t initExFat(uint32_t volumeStartBlock);
+        uint8_t isEOC(uint32_t cluster) const {return cluster >= fatEOCMin_;}
+        uint8_t readVolumeId(uint32_t* cardSerial, uint32_t* volumeSerial);
         uint8_t readBlock(uint32_t block, uint8_t* dst) {
             return sdCard_->readBlock(block, dst);
         }
+        uint8_t readBlocks(uint32_t block, uint32_t count, uint8_t* dst);
         uint8_t readData(uint32_t block, uint16_t offset,uint16_t count, uint8_t* dst) {
             return sdCard_->readData(block, offset, count, dst);
         }
+        uint8_t volumeStatePut(uint8_t dirty);
+        // mark the volume dirty before its first change
+        uint8_t writeBegin(void) {return volumeDirty_ || volumeStatePut(1);}
         uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
-            return sdCard_->writeBlock(block, dst);
+            return writeBegin() && sdCard_->writeBlock(block, dst);
         }
+        uint8_t writeBlocks(uint32_t block, uint32_t count, const uint8_t* src);
+        uint8_t zeroBlocks(uint32_t blockNumber, uint32_t count);
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SdChecker
+ * \brief Incremental consistency check of a FAT16 or FAT32 volume.
+ *
+ * The checker walks the directory tree and every cluster chain, then
+ * compares the clusters it found with the FAT.  Each call to step()
+ * does a limited amount of work so a check can share the main loop
+ * with an application that is logging data.
+ *
+ * Clusters are tracked in a bitmap supplied by the caller, one bit per
+ * cluster.  If the bitmap is smaller than the volume, the tree is walked
+ * once for each window of clusters the bitmap can hold.
+ *
+ * The checker reads the volume through its Sd2Card, there is no block
+ * device layer for checking a card image offline on a host.
+ */
+class SdChecker {
+    public:
+        /** Create an instance of SdChecker. */
+        SdChecker(void) : vol_(0) {}
+        uint8_t begin(SdVolume* vol, uint8_t* bitmap, uint16_t size, uint8_t reclaim = false);
+        /** \return Number of chains with a free, bad or out of range link. */
+        uint32_t badChains(void) const {return badChains_;}
+        /** \return Number of extra references to clusters used by two chains. */
+        uint32_t crossLinks(void) const {return crossLinks_;}
+        /** \return Number of directories checked, not counting root. */
+        uint32_t dirCount(void) const {return dirCount_;}
+        /** \return Number of files checked. */
+        uint32_t fileCount(void) const {return fileCount_;}
+        /** \return Number of allocated clusters that are not in any chain. */
+        uint32_t lostClusters(void) const {return lostClusters_;}
+        /** \return Number of lost clusters that were freed. */
+        uint32_t reclaimed(void) const {return reclaimed_;}
+        /** \return Number of files with a chain that does not match the file size. */
+        uint32_t sizeErrors(void) const {return sizeErrors_;}
+        /**
+         * \return Number of directories that could not be checked because
+         * they are nested too deep or could not be read.
+         */
+        uint32_t skippedDirs(void) const {return skippedDirs_;}
+        int8_t step(uint16_t millisBudget = 0);
+    private:
+        // deepest directory that is checked, root is level zero
+        static uint8_t const MAX_DEPTH = 7;
+        // values for state_
+        static uint8_t const STATE_TREE = 0;
+        static uint8_t const STATE_FAT = 1;
+        static uint8_t const STATE_DONE = 2;
+
+        SdVolume* vol_;               // volume being checked
+        uint8_t* bitmap_;             // one bit per cluster in the window
+        uint32_t winSize_;            // number of clusters in a window
+        uint32_t winStart_;           // first cluster in the window
+        uint8_t reclaim_;             // free lost clusters if true
+        uint8_t state_;               // STATE_TREE, STATE_FAT or STATE_DONE
+        uint8_t depth_;               // index of current directory in dir_
+        SdFile dir_[MAX_DEPTH + 1];   // open directories from root down
+        uint32_t chainNext_;          // next cluster of the chain being walked
+        uint32_t chainLinks_;         // clusters found in the chain so far
+        uint32_t chainExpect_;        // clusters required by the file size
+        uint8_t chainOk_;             // chain ended with EOC and has no loop
+        uint8_t subDirPending_;       // open subDirIndex_ when its chain is walked
+        uint16_t subDirIndex_;        // index of subdirectory in current directory
+        uint32_t fatNext_;            // next FAT entry to compare with bitmap
+
+        uint32_t badChains_;
+        uint32_t crossLinks_;
+        uint32_t dirCount_;
+        uint32_t fileCount_;
+        uint32_t lostClusters_;
+        uint32_t reclaimed_;
+        uint32_t sizeErrors_;
+        uint32_t skippedDirs_;
+
+        uint8_t chainBegin(uint32_t cluster, uint32_t size, uint8_t isDir);
+        uint8_t chainStep(void);
+        uint8_t fatStep(void);
+        uint8_t treeBegin(void);
+        uint8_t treeStep(void);
 };
 
 #endif
@@ -34,8 +34,27 @@ void (*SdFile::oldDateTime_)(uint16_t& date, uint16_t& time) = NULL;  // NOLINT
 //------------------------------------------------------------------------------
 // add a cluster to a file
 uint8_t SdFile::addCluster() {
-  if (!vol_->allocContiguous(1, &curCluster_)) return false;
-
+  // last cluster of file, zero if file is empty
+  uint32_t last = curCluster_;
+
+  if (!vol_->allocContiguous(1, &curCluster_, allocPolicy_)) return false;
+
+  if (vol_->fatType() == FAT_TYPE_EXFAT) {
+    if (firstCluster_ == 0) {
+      // new chain starts with no FAT entries
+      flags_ |= F_FILE_CONTIGUOUS;
+    } else if ((flags_ & F_FILE_CONTIGUOUS) && curCluster_ != (last + 1)) {
+      // file is no longer contiguous - add its clusters to the FAT
+      if (!vol_->fatPutRun(firstCluster_, last - firstCluster_ + 1)) return false;
+      flags_ &= ~F_FILE_CONTIGUOUS;
+      flags_ |= F_FILE_DIR_DIRTY;
+    }
+    if (!(flags_ & F_FILE_CONTIGUOUS)) {
+      // link new cluster
+      if (!vol_->fatPutEOC(curCluster_)) return false;
+      if (firstCluster_ && !vol_->fatPut(last, curCluster_)) return false;
+    }
+  }
   // if first cluster of file link to directory entry
   if (firstCluster_ == 0) {
     firstCluster_ = curCluster_;
@@ -51,19 +70,29 @@ uint8_t SdFile::addDirCluster(void) {
 
   // zero data in cluster insure first cluster is in cache
   uint32_t block = vol_->clusterStartBlock(curCluster_);
-  for (uint8_t i = vol_->blocksPerCluster_; i != 0; i--) {
-    if (!SdVolume::cacheZeroBlock(block + i - 1)) return false;
-  }
+  if (!vol_->zeroBlocks(block, vol_->blocksPerCluster_)) return false;
   // Increase directory file size by cluster size
   fileSize_ += 512UL << vol_->clusterSizeShift_;
+
+  // exFAT directory size is in its directory entry
+  if (vol_->fatType() == FAT_TYPE_EXFAT) flags_ |= F_FILE_DIR_DIRTY;
   return true;
 }
 //------------------------------------------------------------------------------
 // cache a file's directory entry
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
-  if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  if (!vol_->cacheRawBlock(dirBlock_, action)) return NULL;
+  return vol_->cacheBuffer_.dir + dirIndex_;
+}
+//------------------------------------------------------------------------------
+// cache entry i of a file's exFAT entry set
+// return pointer to cached entry or null for failure
+dir_t* SdFile::cacheSetEntry(uint8_t i, uint8_t action) {
+  uint8_t index = dirIndex_ + i;
+  uint32_t block = index < 16 ? dirBlock_ : dirNextBlock_;
+  if (!vol_->cacheRawBlock(block, action)) return NULL;
+  return vol_->cacheBuffer_.dir + (index & 0XF);
 }
 //------------------------------------------------------------------------------
 /**
@@ -80,6 +109,188 @@ uint8_t SdFile::close(void) {
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Compact a directory a few entries at a time.
+ *
+ * Entries in use are moved toward the front of the directory over the
+ * entries of removed files, long name entries stay in front of their
+ * short name entry.  When all entries have been moved, clusters past
+ * the last entry are freed and the rest of the directory is marked free
+ * so a search of the directory stops at its last file.
+ *
+ * Each call examines, frees or marks free at most \a count entries or
+ * clusters and returns.  Call again until zero is returned.  A long name
+ * and its short name entry move in one call, the first move of a call
+ * may exceed \a count if the name has more entries.  An entry is
+ * written at its new place before the old entry is marked deleted.  A
+ * power failure between the two writes leaves two entries for one file
+ * that share its clusters.  Remove neither copy until the duplicate has
+ * been repaired by a disk check, removing one frees the data of the
+ * other.  A power failure while clusters are freed may leave up to
+ * \a count clusters allocated but not in any file.
+ *
+ * Files in the directory must be closed until compaction is done since
+ * their directory entries move.  Creating a file in the directory with
+ * this SdFile starts compaction over.  Only FAT16 and FAT32 directories
+ * can be compacted.
+ *
+ * \param[in] count Maximum number of entries or clusters for this call.
+ *
+ * \return The value one is returned if compaction is not done, zero
+ * is returned when it is done and -1 is returned for an error.
+ * Reasons for failure include this SdFile is not a directory, the
+ * volume is exFAT, \a count is zero or an I/O error occurred.
+ */
+int8_t SdFile::compactDir(uint16_t count) {
+  if (!isDir() || vol_->fatType() == FAT_TYPE_EXFAT || count == 0) return -1;
+
+  // entries before compactWrite_ are packed, new pass if compactRead_ is zero
+  if (compactRead_ == 0 && !compactTail_) compactWrite_ = 0;
+
+  if (!compactTail_) {
+    // block and index of the entry at compactWrite_, found when needed
+    uint32_t wBlock = 0;
+    uint8_t wIndex = 0;
+
+    // count when this call started, the first move may exceed it
+    uint16_t limit = count;
+
+    if (!seekSet(32UL * compactRead_)) return -1;
+    while (curPosition_ < fileSize_) {
+      if (count == 0) {
+        if (!vol_->cacheSync()) return -1;
+        return 1;
+      }
+      dir_t* p = readDirCache();
+      if (p == NULL) return -1;
+
+      // no entries follow a free entry
+      if (p->name[0] == DIR_NAME_FREE) break;
+
+      if (p->name[0] == DIR_NAME_DELETED || compactWrite_ == compactRead_) {
+        // entry is removed or in place
+        if (p->name[0] != DIR_NAME_DELETED) compactWrite_++;
+        compactRead_++;
+        count--;
+        continue;
+      }
+      // a long name moves with its short name entry in one call so
+      // open() never finds part of the set
+      uint8_t n = 1;
+      uint8_t sum = reinterpret_cast<ldir_t*>(p)->checksum;
+      if (DIR_IS_LONG_NAME(p) && (p->name[0] & LDIR_ORD_LAST_LONG_ENTRY)) {
+        n = (p->name[0] & 0X1F) + 1;
+        if (n > count && count < limit) {
+          if (!vol_->cacheSync()) return -1;
+          return 1;
+        }
+      }
+      if (wBlock == 0) {
+        // locate the first entry that is not packed
+        if (!seekSet(32UL * compactWrite_)) return -1;
+        if (!readDirCache()) return -1;
+        wBlock = vol_->cacheBlockNumber_;
+        wIndex = 0XF & compactWrite_;
+        if (!seekSet(32UL * compactRead_)) return -1;
+        p = readDirCache();
+        if (p == NULL) return -1;
+      }
+      uint8_t i = 0;
+      while (i < n) {
+        if (i) {
+          // a set that is not complete ends at the first entry not in it
+          if (curPosition_ >= fileSize_) break;
+          p = readDirCache();
+          if (p == NULL) return -1;
+          if (!lfnInSet(p, sum, n - 1 - i)) {
+            if (!seekSet(32UL * compactRead_)) return -1;
+            break;
+          }
+        }
+        uint32_t rBlock = vol_->cacheBlockNumber_;
+        uint8_t rIndex = 0XF & compactRead_;
+        dir_t d = *p;
+
+        // copy entry to its new place then mark the old entry deleted
+        if (!vol_->cacheRawBlock(wBlock, SdVolume::CACHE_FOR_WRITE)) return -1;
+        vol_->cacheBuffer_.dir[wIndex] = d;
+        if (!vol_->cacheRawBlock(rBlock, SdVolume::CACHE_FOR_WRITE)) return -1;
+        vol_->cacheBuffer_.dir[rIndex].name[0] = DIR_NAME_DELETED;
+        nameIndexPut(compactWrite_, nameHash(d.name));
+        nameIndexPut(compactRead_, 0);
+
+        // forget end clusters remembered for the old and new place
+        vol_->endClusterPut(rBlock, rIndex, 0, 0, 0);
+        vol_->endClusterPut(wBlock, wIndex, 0, 0, 0);
+
+        // the next entry exists since it is at or before compactRead_
+        compactRead_++;
+        compactWrite_++;
+        i++;
+        if (!lfnNext(&wBlock, &wIndex)) return -1;
+      }
+      count = i < count ? count - i : 0;
+    }
+    // all entries are packed, compactRead_ is now the end of the search
+    compactTail_ = true;
+  }
+  // free clusters past the last entry, keep one cluster
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+  uint32_t keep = compactWrite_ ? ((32UL * compactWrite_ - 1) >> shift) + 1 : 1;
+  if (type_ != FAT_FILE_TYPE_ROOT16 && (keep << shift) < fileSize_) {
+    // clusters past keep are no longer in the caches
+    extentTrim(keep);
+    if (endIndex_ >= keep) endCluster_ = 0;
+
+    // last cluster that is kept
+    if (!seekSet(keep << shift)) return -1;
+    uint32_t last = curCluster_;
+
+    while ((keep << shift) < fileSize_) {
+      if (count == 0) {
+        if (!vol_->cacheSync()) return -1;
+        return 1;
+      }
+      uint32_t n = (fileSize_ >> shift) - keep;
+      if (n > count) n = count;
+
+      // unlink n clusters from the chain then free them
+      uint32_t first;
+      if (!vol_->fatGet(last, &first)) return -1;
+      uint32_t next = first;
+      uint32_t m = n;
+      if (!vol_->fatFollow(&next, &m, SdVolume::CACHE_FOR_READ) || m != n) return -1;
+      if (!vol_->fatPut(last, next)) return -1;
+      if (!vol_->fatFollow(&first, &m, SdVolume::CACHE_FOR_WRITE)) return -1;
+      fileSize_ -= n << shift;
+      count -= n;
+    }
+    if (nameIndexCount_ > (fileSize_ >> 5)) nameIndexCount_ = fileSize_ >> 5;
+  }
+  // mark entries free from the last entry to the end of the search
+  uint32_t end = fileSize_ >> 5;
+  if (compactRead_ < end) end = compactRead_;
+  if (compactWrite_ < end) {
+    if (!seekSet(32UL * compactWrite_)) return -1;
+    while (compactWrite_ < end) {
+      if (count-- == 0) {
+        if (!vol_->cacheSync()) return -1;
+        return 1;
+      }
+      dir_t* p = readDirCache();
+      if (p == NULL) return -1;
+      if (!vol_->cacheRawBlock(vol_->cacheBlockNumber_, SdVolume::CACHE_FOR_WRITE)) {
+        return -1;
+      }
+      memset(p, 0, sizeof(dir_t));
+      compactWrite_++;
+    }
+  }
+  compactRead_ = 0;
+  compactTail_ = false;
+  return vol_->cacheSync() ? 0 : -1;
+}
+//------------------------------------------------------------------------------
 /**
  * Check for contiguous file and return its raw block range.
  *
@@ -95,6 +306,14 @@ uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
   // error if no blocks
   if (firstCluster_ == 0) return false;
 
+  if (flags_ & F_FILE_CONTIGUOUS) {
+    // exFAT file with no FAT chain, its size gives the number of clusters
+    if (fileSize_ == 0) return false;
+    uint32_t count = ((fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+    *bgnBlock = vol_->clusterStartBlock(firstCluster_);
+    *endBlock = vol_->clusterStartBlock(firstCluster_ + count) - 1;
+    return true;
+  }
   for (uint32_t c = firstCluster_; ; c++) {
     uint32_t next;
     if (!vol_->fatGet(c, &next)) return false;
@@ -117,6 +336,9 @@ uint8_t SdFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
  * \note This function only supports short DOS 8.3 names.
  * See open() for more information.
  *
+ * The clusters are allocated but not zeroed, the file's data is what
+ * the clusters held before.
+ *
  * \param[in] dirFile The directory where the file will be created.
  * \param[in] fileName A valid DOS 8.3 file name.
  * \param[in] size The desired file size.
@@ -139,12 +361,15 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
   uint32_t count = ((size - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
 
   // allocate clusters
-  if (!vol_->allocContiguous(count, &firstCluster_)) {
+  if (!vol_->allocContiguous(count, &firstCluster_, allocPolicy_)) {
     remove();
     return false;
   }
   fileSize_ = size;
 
+  // exFAT file needs no FAT chain
+  if (vol_->fatType() == FAT_TYPE_EXFAT) flags_ |= F_FILE_CONTIGUOUS;
+
   // insure sync() will update dir entry
   flags_ |= F_FILE_DIR_DIRTY;
   return sync();
@@ -157,8 +382,11 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
+ * Files on exFAT volumes have no dir_t entry and fail.
  */
 uint8_t SdFile::dirEntry(dir_t* dir) {
+  if (vol_->fatType() == FAT_TYPE_EXFAT) return false;
+
   // make sure fields on SD are correct
   if (!sync()) return false;
 
@@ -171,6 +399,25 @@ uint8_t SdFile::dirEntry(dir_t* dir) {
   return true;
 }
 //------------------------------------------------------------------------------
+// initialize a directory entry for an empty file
+void SdFile::dirEntryInit(dir_t* p, const uint8_t* name) {
+  memset(p, 0, sizeof(dir_t));
+  memcpy(p->name, name, 11);
+
+  // set timestamps
+  if (dateTime_) {
+    // call user function
+    dateTime_(&p->creationDate, &p->creationTime);
+  } else {
+    // use default date/time
+    p->creationDate = FAT_DEFAULT_DATE;
+    p->creationTime = FAT_DEFAULT_TIME;
+  }
+  p->lastAccessDate = p->creationDate;
+  p->lastWriteDate = p->creationDate;
+  p->lastWriteTime = p->creationTime;
+}
+//------------------------------------------------------------------------------
 /**
  * Format the name field of \a dir into the 13 byte array
  * \a name in standard 8.3 short name format.
@@ -188,6 +435,266 @@ void SdFile::dirName(const dir_t& dir, char* name) {
   name[j] = 0;
 }
 //------------------------------------------------------------------------------
+// find the volume cluster for a cluster index of the file in the extent cache
+uint8_t SdFile::extentGet(uint32_t index, uint32_t* cluster) const {
+  if (!extent_ || extentCount_ == 0) return false;
+
+  // binary search for last extent that starts at or before index
+  uint8_t lo = 0;
+  uint8_t hi = extentCount_;
+  while ((hi - lo) > 1) {
+    uint8_t mid = (lo + hi) >> 1;
+    if (extent_[mid].fileCluster <= index) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const extent_t* e = extent_ + lo;
+  if ((index - e->fileCluster) >= e->length) return false;
+  *cluster = e->diskCluster + index - e->fileCluster;
+  return true;
+}
+//------------------------------------------------------------------------------
+// add a cluster to the extent cache if it follows the cached part of the chain
+void SdFile::extentPut(uint32_t index, uint32_t cluster) {
+  if (!extent_) return;
+
+  if (extentCount_) {
+    extent_t* e = extent_ + extentCount_ - 1;
+
+    // only the next cluster of the chain can be added
+    if (index != (e->fileCluster + e->length)) return;
+
+    // extend last extent if contiguous
+    if (cluster == (e->diskCluster + e->length)) {
+      e->length++;
+      return;
+    }
+  } else if (index != 0) {
+    return;
+  }
+  // start a new extent if there is space
+  if (extentCount_ < extentMax_) {
+    extent_t* e = extent_ + extentCount_++;
+    e->fileCluster = index;
+    e->diskCluster = cluster;
+    e->length = 1;
+  }
+}
+//------------------------------------------------------------------------------
+// remove clusters with index greater than or equal to count from extent cache
+void SdFile::extentTrim(uint32_t count) {
+  if (!extent_) return;
+
+  while (extentCount_ && extent_[extentCount_ - 1].fileCluster >= count) {
+    extentCount_--;
+  }
+  if (extentCount_) {
+    extent_t* e = extent_ + extentCount_ - 1;
+    if ((e->fileCluster + e->length) > count) e->length = count - e->fileCluster;
+  }
+}
+//------------------------------------------------------------------------------
+/**
+ * Count the runs of contiguous clusters in a file or directory.
+ *
+ * A file with one fragment is contiguous.  Each extra fragment costs a
+ * seek and a new multiple block command when the file is read or written.
+ *
+ * \param[out] count The number of fragments, zero for a file with no data.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  Reasons for failure
+ * include the file is not open, a bad cluster chain or an I/O error.
+ */
+uint8_t SdFile::fragmentCount(uint32_t* count) {
+  if (!isOpen()) return false;
+
+  *count = 0;
+  if (firstCluster_ == 0) return true;
+
+  // exFAT file with no FAT chain
+  if (flags_ & F_FILE_CONTIGUOUS) {
+    *count = 1;
+    return true;
+  }
+  uint32_t n = 1;
+  uint32_t c = firstCluster_;
+  // more links than clusters is a loop
+  for (uint32_t i = 0; i < vol_->clusterCount(); i++) {
+    uint32_t next;
+    if (!vol_->fatGet(c, &next)) return false;
+    if (vol_->isEOC(next)) {
+      *count = n;
+      return true;
+    }
+    if (next != (c + 1)) n++;
+    c = next;
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+// character i of the part of a long name in l
+static uint16_t lfnChar(const ldir_t* l, uint8_t i) {
+  if (i < 5) return l->name1[i];
+  if (i < 11) return l->name2[i - 5];
+  return l->name3[i - 11];
+}
+//------------------------------------------------------------------------------
+// set character i of the part of a long name in l
+static void lfnCharPut(ldir_t* l, uint8_t i, uint16_t c) {
+  if (i < 5) {
+    l->name1[i] = c;
+  } else if (i < 11) {
+    l->name2[i - 5] = c;
+  } else {
+    l->name3[i - 11] = c;
+  }
+}
+//------------------------------------------------------------------------------
+// checksum of a short name, stored in each of its long name entries
+static uint8_t lfnChecksum(const uint8_t* name) {
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  }
+  return sum;
+}
+//------------------------------------------------------------------------------
+// copy the characters of a long name entry to their place in name,
+// characters that are not ASCII are replaced by '?'
+static void lfnGet(const ldir_t* l, char* name, uint16_t size) {
+  uint16_t k = ((l->ord & 0X1F) - 1) * LDIR_NAME_CHARS;
+  for (uint8_t i = 0; i < LDIR_NAME_CHARS && k < (size - 1); i++, k++) {
+    uint16_t c = lfnChar(l, i);
+    if (c == 0) {
+      name[k] = 0;
+      break;
+    }
+    name[k] = c < 0X80 ? c : '?';
+  }
+}
+//------------------------------------------------------------------------------
+// terminate name after the last part of a long name, l is the first entry
+static void lfnTerminate(const ldir_t* l, char* name, uint16_t size) {
+  uint16_t k = (l->ord & 0X1F) * LDIR_NAME_CHARS;
+  name[k < size ? k : size - 1] = 0;
+}
+//------------------------------------------------------------------------------
+/**
+ * Get the name of an open file or directory.
+ *
+ * The long name is returned if the file has one, otherwise the 8.3 name
+ * is returned in the same format as dirName().  Characters that are not
+ * ASCII are returned as '?'.  A name with \a size or more characters is
+ * truncated.
+ *
+ * \param[out] name Location for the name.
+ *
+ * \param[in] size Size of \a name, at least 13 bytes.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open, the file is a root
+ * directory, \a size is too small or an I/O error occurred.
+ */
+uint8_t SdFile::getName(char* name, uint16_t size) {
+  if (!isOpen() || isRoot() || size < 13) return false;
+
+  if (vol_->fatType() == FAT_TYPE_EXFAT) {
+    // exFAT name entries hold 15 characters each
+    xds_t* s = reinterpret_cast<xds_t*>(cacheSetEntry(1, SdVolume::CACHE_FOR_READ));
+    if (!s) return false;
+    uint8_t length = s->nameLength;
+    if (length >= size) length = size - 1;
+    xdn_t* n = 0;
+    for (uint8_t i = 0; i < length; i++) {
+      if ((i % 15) == 0) {
+        n = reinterpret_cast<xdn_t*>(cacheSetEntry(2 + i / 15, SdVolume::CACHE_FOR_READ));
+        if (!n) return false;
+      }
+      uint16_t c = n->name[i % 15];
+      name[i] = c < 0X80 ? c : '?';
+    }
+    name[length] = 0;
+    return true;
+  }
+  if (lfnCount_) {
+    uint32_t block = lfnBlock_;
+    uint8_t index = lfnIndex_;
+    for (uint8_t i = 0; i < lfnCount_; i++) {
+      if (i && !lfnNext(&block, &index)) return false;
+      if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return false;
+      ldir_t* l = reinterpret_cast<ldir_t*>(vol_->cacheBuffer_.dir + index);
+      if (i == 0) lfnTerminate(l, name, size);
+      lfnGet(l, name, size);
+    }
+    return true;
+  }
+  dir_t* p = cacheDirEntry(SdVolume::CACHE_FOR_READ);
+  if (!p) return false;
+  dirName(*p, name);
+  return true;
+}
+//------------------------------------------------------------------------------
+// Find the long name entries before the short name entry at slot of
+// dirFile.  Leaves dirFile positioned after the short name entry with
+// its block in the cache.
+uint8_t SdFile::lfnFind(SdFile* dirFile, uint32_t slot) {
+  lfnCount_ = 0;
+  if (!dirFile->seekSet(32UL * slot)) return false;
+  dir_t* p = dirFile->readDirCache();
+  if (!p) return false;
+  uint8_t sum = lfnChecksum(p->name);
+
+  // entries before the short name have ord 1, 2, ...
+  for (uint8_t n = 1; n <= slot && n <= (LFN_NAME_MAX + 12) / 13; n++) {
+    if (!dirFile->seekSet(32UL * (slot - n))) return false;
+    ldir_t* l = reinterpret_cast<ldir_t*>(dirFile->readDirCache());
+    if (!l) return false;
+    if (!DIR_IS_LONG_NAME(reinterpret_cast<dir_t*>(l)) || l->checksum != sum
+      || (l->ord & 0X1F) != n) break;
+    if (l->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+      lfnCount_ = n;
+      lfnBlock_ = vol_->cacheBlockNumber_;
+      lfnIndex_ = 0XF & (slot - n);
+      break;
+    }
+  }
+  if (!dirFile->seekSet(32UL * slot)) return false;
+  return dirFile->readDirCache() != NULL;
+}
+//------------------------------------------------------------------------------
+// true if p is the entry with ord of the long name set with checksum sum,
+// ord zero for the set's short name entry
+uint8_t SdFile::lfnInSet(const dir_t* p, uint8_t sum, uint8_t ord) {
+  if (ord == 0) {
+    return p->name[0] != DIR_NAME_FREE && p->name[0] != DIR_NAME_DELETED
+      && !DIR_IS_LONG_NAME(p) && lfnChecksum(p->name) == sum;
+  }
+  const ldir_t* l = reinterpret_cast<const ldir_t*>(p);
+  return DIR_IS_LONG_NAME(p) && l->ord == ord && l->checksum == sum;
+}
+//------------------------------------------------------------------------------
+// advance block and index to the next entry of the directory that holds
+// this file's long name, or of this directory for compactDir()
+uint8_t SdFile::lfnNext(uint32_t* block, uint8_t* index) {
+  if (++*index < 16) return true;
+  *index = 0;
+  (*block)++;
+
+  // FAT16 root directory blocks are before the data area and contiguous
+  uint32_t offset = *block - vol_->dataStartBlock_;
+  if (*block > vol_->dataStartBlock_ && !(offset & (vol_->blocksPerCluster_ - 1))) {
+    // first block of the next cluster in the directory's chain
+    uint32_t cluster = ((offset - 1) >> vol_->clusterSizeShift_) + 2;
+    if (!vol_->fatGet(cluster, &cluster)) return false;
+    *block = vol_->clusterStartBlock(cluster);
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /** List directory contents to Serial.
  *
  * \param[in] flags The inclusive OR of
@@ -200,10 +707,14 @@ void SdFile::dirName(const dir_t& dir, char* name) {
  *
  * \param[in] indent Amount of space before file name. Used for recursive
  * list to indicate subdirectory level.
+ *
+ * \note Nothing is listed for exFAT directories.
  */
 void SdFile::ls(uint8_t flags, uint8_t indent) {
   dir_t* p;
 
+  if (vol_->fatType() == FAT_TYPE_EXFAT) return;
+
   rewind();
   while ((p = readDirCache())) {
     // done if past last used entry
@@ -276,6 +787,33 @@ uint8_t SdFile::make83Name(const char* str, uint8_t* name) {
   return name[0] != ' ';
 }
 //------------------------------------------------------------------------------
+// check an exFAT file name and return its length and name hash
+uint8_t SdFile::makeExFatName(const char* str, uint8_t* length, uint16_t* hash) {
+  uint8_t c;
+  uint8_t n = 0;
+  uint16_t h = 0;
+  while ((c = *str++) != '\0') {
+    // illegal exFAT characters
+    char p[10] = {"\"*/:<>?\\|"};
+    char *ptr = p;
+    uint8_t b;
+    while ((b = *(ptr++)))
+      if (b == c)
+        return false;
+    // an entry set with a longer name may not fit in two blocks
+    if (n == EXFAT_NAME_MAX || c < 0X20 || c > 0X7E) return false;
+    n++;
+
+    // hash is of the up-cased UTF-16 name
+    if (c >= 'a' && c <= 'z') c += 'A' - 'a';
+    h = ((h & 1) ? 0X8000 : 0) + (h >> 1) + c;
+    h = ((h & 1) ? 0X8000 : 0) + (h >> 1);
+  }
+  *length = n;
+  *hash = h;
+  return n != 0;
+}
+//------------------------------------------------------------------------------
 /** Make a new directory.
  *
  * \param[in] dir An open SdFat instance for the directory that will containing
@@ -301,6 +839,13 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
   // allocate and zero first cluster
   if (!addDirCluster())return false;
 
+  if (vol_->fatType() == FAT_TYPE_EXFAT) {
+    // exFAT directory has no '.' or '..' entries
+    xdf_t* x = reinterpret_cast<xdf_t*>(cacheSetEntry(0, SdVolume::CACHE_FOR_WRITE));
+    if (!x) return false;
+    x->attributes = DIR_ATT_DIRECTORY;
+    return sync();
+  }
   // force entry to SD
   if (!sync()) return false;
 
@@ -318,10 +863,10 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
 
   // cache block for '.'  and '..'
   uint32_t block = vol_->clusterStartBlock(firstCluster_);
-  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
+  if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
 
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&vol_->cacheBuffer_.dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -333,13 +878,54 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&vol_->cacheBuffer_.dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
 
   // write first block
-  return SdVolume::cacheFlush();
+  return vol_->cacheSync();
+}
+//------------------------------------------------------------------------------
+// hash of an 8.3 name for the name index, zero is not used
+uint16_t SdFile::nameHash(const uint8_t* name) {
+  uint16_t h = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    h = ((h << 5) | (h >> 11)) ^ name[i];
+  }
+  return h ? h : 1;
+}
+//------------------------------------------------------------------------------
+// read the directory and store the name hash of each entry in the index
+uint8_t SdFile::nameIndexBuild(void) {
+  uint32_t n = fileSize_ >> 5;
+  if (n > nameIndexMax_) n = nameIndexMax_;
+  rewind();
+  uint16_t i = 0;
+  while (i < n) {
+    dir_t* p = readDirCache();
+    if (p == NULL) return false;
+    if (p->name[0] == DIR_NAME_FREE) break;
+    nameIndex_[i++] = p->name[0] == DIR_NAME_DELETED ? 0 : nameHash(p->name);
+  }
+  // no entries follow a free entry
+  while (i < n) nameIndex_[i++] = 0;
+  nameIndexCount_ = n;
+  return true;
+}
+//------------------------------------------------------------------------------
+// add the free entries of a new directory cluster to the index if the
+// index ended at slot, the old end of the directory
+void SdFile::nameIndexGrow(uint32_t slot) {
+  if (!nameIndex_ || nameIndexCount_ != slot) return;
+  uint32_t n = fileSize_ >> 5;
+  if (n > nameIndexMax_) n = nameIndexMax_;
+  while (nameIndexCount_ < n) nameIndex_[nameIndexCount_++] = 0;
+}
+//------------------------------------------------------------------------------
+// set the name hash of an entry, zero for a free entry
+void SdFile::nameIndexPut(uint32_t slot, uint16_t hash) {
+  if (nameIndex_ && slot < nameIndexCount_) nameIndex_[slot] = hash;
 }
 //------------------------------------------------------------------------------
 /**
@@ -379,9 +965,23 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
  * O_TRUNC - If the file exists and is a regular file, and the file is
  * successfully opened and is not read only, its length shall be truncated to 0.
  *
+ * O_DIRECT - File data moves between the caller's buffer and the card
+ * without using the cache.  The file position and the length of each
+ * read or write must be a multiple of 512 bytes, except that a read may
+ * end at end of file.  Ignored for directories.
+ *
  * \note Directory files must be opened read only.  Write and truncation is
  * not allowed for directory files.
  *
+ * \note On exFAT volumes \a fileName may be any name of up to
+ * EXFAT_NAME_MAX printable ASCII characters.  Names are matched without
+ * regard to case for ASCII letters.
+ *
+ * \note On FAT16 and FAT32 volumes a \a fileName that is not a valid 8.3
+ * name is a long name of up to LFN_NAME_MAX printable ASCII characters.
+ * Long names are matched without regard to case for ASCII letters and a
+ * new file gets an 8.3 alias of the form NAME~1.EXT.
+ *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
  * Reasons for failure include this SdFile is already open, \a difFile is not
@@ -395,13 +995,76 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
   // error if already open
   if (isOpen())return false;
 
-  if (!make83Name(fileName, dname)) return false;
+  if (dirFile->vol_->fatType() == FAT_TYPE_EXFAT) {
+    return openExFat(dirFile, fileName, oflag);
+  }
+
+  // a name that is not a valid 8.3 name needs long name entries
+  if (!make83Name(fileName, dname)) return openLfn(dirFile, fileName, oflag);
   vol_ = dirFile->vol_;
   dirFile->rewind();
 
   // bool for empty entry found
   uint8_t emptyFound = false;
 
+  // position of the entry in the directory divided by 32
+  uint32_t slot = 0;
+
+  // check only the entries with the same name hash if dirFile has an index
+  uint16_t hash = nameHash(dname);
+  if (dirFile->nameIndex_) {
+    if (!dirFile->nameIndexCount_ && !dirFile->nameIndexBuild()) return false;
+    uint16_t n = dirFile->nameIndexCount_;
+    uint16_t freeSlot = n;
+    for (uint16_t i = 0; i < n; i++) {
+      uint16_t h = dirFile->nameIndex_[i];
+      if (h == 0) {
+        if (freeSlot == n) freeSlot = i;
+        continue;
+      }
+      if (h != hash) continue;
+      if (!dirFile->seekSet(32UL * i)) return false;
+      p = dirFile->readDirCache();
+      if (p == NULL) return false;
+      if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED) {
+        // file was removed without the index
+        dirFile->nameIndex_[i] = 0;
+        if (freeSlot > i) freeSlot = i;
+      } else if (!memcmp(dname, p->name, 11)) {
+        if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+        if (!lfnFind(dirFile, i)) return false;
+        return openCachedEntry(0XF & i, oflag);
+      }
+    }
+    // check the free slots if a file may be created, another handle
+    // may have added the file there without the index
+    for (uint16_t i = freeSlot; i < n && (oflag & O_CREAT); i++) {
+      if (dirFile->nameIndex_[i]) continue;
+      if (!dirFile->seekSet(32UL * i)) return false;
+      p = dirFile->readDirCache();
+      if (p == NULL) return false;
+      if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED) {
+        if (!emptyFound) {
+          emptyFound = true;
+          slot = i;
+          dirIndex_ = 0XF & i;
+          dirBlock_ = vol_->cacheBlockNumber_;
+        }
+        // no entries follow a free entry
+        if (p->name[0] == DIR_NAME_FREE) break;
+        continue;
+      }
+      // entry was added without the index
+      if (!memcmp(dname, p->name, 11)) {
+        if (oflag & O_EXCL) return false;
+        if (!lfnFind(dirFile, i)) return false;
+        return openCachedEntry(0XF & i, oflag);
+      }
+      dirFile->nameIndex_[i] = nameHash(p->name);
+    }
+    // search the part of the directory past the index
+    if (!dirFile->seekSet(32UL * n)) return false;
+  }
   // search for file
   while (dirFile->curPosition_ < dirFile->fileSize_) {
     uint8_t index = 0XF & (dirFile->curPosition_ >> 5);
@@ -412,8 +1075,9 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       // remember first empty slot
       if (!emptyFound) {
         emptyFound = true;
+        slot = (dirFile->curPosition_ >> 5) - 1;
         dirIndex_ = index;
-        dirBlock_ = SdVolume::cacheBlockNumber_;
+        dirBlock_ = vol_->cacheBlockNumber_;
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
@@ -421,6 +1085,9 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       // don't open existing file if O_CREAT and O_EXCL
       if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
 
+      // find any long name entries for remove()
+      if (!lfnFind(dirFile, (dirFile->curPosition_ >> 5) - 1)) return false;
+
       // open found file
       return openCachedEntry(0XF & index, oflag);
     }
@@ -436,31 +1103,25 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
     if (dirFile->type_ == FAT_FILE_TYPE_ROOT16) return false;
 
     // add and zero cluster for dirFile - first cluster is in cache for write
+    slot = dirFile->fileSize_ >> 5;
     if (!dirFile->addDirCluster()) return false;
+    dirFile->nameIndexGrow(slot);
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    p = vol_->cacheBuffer_.dir;
   }
   // initialize as empty file
-  memset(p, 0, sizeof(dir_t));
-  memcpy(p->name, dname, 11);
-
-  // set timestamps
-  if (dateTime_) {
-    // call user function
-    dateTime_(&p->creationDate, &p->creationTime);
-  } else {
-    // use default date/time
-    p->creationDate = FAT_DEFAULT_DATE;
-    p->creationTime = FAT_DEFAULT_TIME;
-  }
-  p->lastAccessDate = p->creationDate;
-  p->lastWriteDate = p->creationDate;
-  p->lastWriteTime = p->creationTime;
+  dirEntryInit(p, dname);
+  lfnCount_ = 0;
 
   // force write of entry to SD
-  if (!SdVolume::cacheFlush()) return false;
+  if (!vol_->cacheSync()) return false;
+  dirFile->nameIndexPut(slot, hash);
+
+  // the new entry may be in the part of dirFile that is being compacted
+  dirFile->compactRead_ = 0;
+  dirFile->compactTail_ = false;
 
   // open entry in cache
   return openCachedEntry(dirIndex_, oflag);
@@ -478,12 +1139,15 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
  * OR of flags O_READ, O_WRITE, O_TRUNC, and O_SYNC.
  *
  * See open() by fileName for definition of flags and return values.
+ * Open by index is not available on exFAT volumes.
  *
  */
 uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
   // error if already open
   if (isOpen())return false;
 
+  if (dirFile->vol_->fatType() == FAT_TYPE_EXFAT) return false;
+
   // don't open existing file if O_CREAT and O_EXCL - user call error
   if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
 
@@ -501,14 +1165,28 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
       p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') {
     return false;
   }
+  // find any long name entries for remove()
+  if (!lfnFind(dirFile, index)) return false;
+
   // open cached entry
   return openCachedEntry(index & 0XF, oflag);
 }
 //------------------------------------------------------------------------------
+// get the cluster after cluster in a file, EOC if cluster is the last
+uint8_t SdFile::nextCluster(uint32_t cluster, uint32_t* next) {
+  if (flags_ & F_FILE_CONTIGUOUS) {
+    // exFAT file with no FAT chain has one cluster for each cluster of data
+    uint32_t count = fileSize_ ? ((fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9)) + 1 : 0;
+    *next = (cluster - firstCluster_ + 1) < count ? cluster + 1 : EXFAT_EOC;
+    return true;
+  }
+  return vol_->fatGet(cluster, next);
+}
+//------------------------------------------------------------------------------
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = vol_->cacheBuffer_.dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -516,7 +1194,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SdVolume::cacheBlockNumber_;
+  dirBlock_ = vol_->cacheBlockNumber_;
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
@@ -534,58 +1212,576 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // save open flags for read/write
   flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+  if ((oflag & O_DIRECT) && isFile()) flags_ |= F_FILE_DIRECT;
 
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
 
+  // no extent cache
+  extent_ = 0;
+
+  // no write buffer
+  wbuf_ = 0;
+  wbufCount_ = 0;
+
+  // no name index or compaction in progress
+  nameIndex_ = 0;
+  nameIndexCount_ = 0;
+  compactRead_ = 0;
+  compactTail_ = false;
+
+  // start seeks near end of file if the volume remembers its last cluster
+  endCluster_ = 0;
+  if (fileSize_ && isFile()) {
+    endIndex_ = (fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9);
+    vol_->endClusterGet(dirBlock_, dirIndex_, firstCluster_, &endIndex_,
+                        &endCluster_);
+  }
+
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) return truncate(0);
   return true;
 }
 //------------------------------------------------------------------------------
-/**
- * Open a volume's root directory.
- *
- * \param[in] vol The FAT volume containing the root directory to be opened.
- *
- * \return The value one, true, is returned for success and
- * the value zero, false, is returned for failure.
- * Reasons for failure include the FAT volume has not been initialized
- * or it a FAT12 volume.
- */
-uint8_t SdFile::openRoot(SdVolume* vol) {
-  // error if file is already open
-  if (isOpen()) return false;
+// open the exFAT entry set at dirBlock_ and dirIndex_. Assumes vol_,
+// dirNextBlock_ and dirCount_ are initialized
+uint8_t SdFile::openCachedSet(uint8_t oflag) {
+  xdf_t* x = reinterpret_cast<xdf_t*>(cacheSetEntry(0, SdVolume::CACHE_FOR_READ));
+  if (!x) return false;
+  uint16_t attributes = x->attributes;
 
-  if (vol->fatType() == 16) {
-    type_ = FAT_FILE_TYPE_ROOT16;
-    firstCluster_ = 0;
-    fileSize_ = 32 * vol->rootDirEntryCount();
-  } else if (vol->fatType() == 32) {
-    type_ = FAT_FILE_TYPE_ROOT32;
-    firstCluster_ = vol->rootDirStart();
-    if (!vol->chainSize(firstCluster_, &fileSize_)) return false;
-  } else {
-    // volume is not initialized or FAT12
-    return false;
+  // write or truncate is an error for a directory or read-only file
+  if (attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
+    if (oflag & (O_WRITE | O_TRUNC)) return false;
   }
-  vol_ = vol;
-  // read only
-  flags_ = O_READ;
+  xds_t* s = reinterpret_cast<xds_t*>(cacheSetEntry(1, SdVolume::CACHE_FOR_READ));
+  if (!s || s->type != EXFAT_TYPE_STREAM) return false;
+
+  // file size is limited to 32 bits
+  if (s->dataLength >> 32) return false;
 
+  // a file with unwritten allocated space may only be read
+  if (s->validDataLength != s->dataLength && (oflag & (O_WRITE | O_TRUNC))) {
+    return false;
+  }
+  firstCluster_ = s->firstCluster;
+  if (attributes & DIR_ATT_DIRECTORY) {
+    fileSize_ = s->dataLength;
+    type_ = FAT_FILE_TYPE_SUBDIR;
+  } else {
+    fileSize_ = s->validDataLength;
+    type_ = FAT_FILE_TYPE_NORMAL;
+  }
+  // save open flags for read/write
+  flags_ = oflag & (O_ACCMODE | O_SYNC | O_APPEND);
+  if ((oflag & O_DIRECT) && isFile()) flags_ |= F_FILE_DIRECT;
+  if (firstCluster_ && (s->flags & EXFAT_FLAG_NO_FAT_CHAIN)) {
+    flags_ |= F_FILE_CONTIGUOUS;
+  }
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
 
-  // root has no directory entry
-  dirBlock_ = 0;
-  dirIndex_ = 0;
+  // no extent cache
+  extent_ = 0;
+
+  // no write buffer
+  wbuf_ = 0;
+  wbufCount_ = 0;
+
+  // no name index or compaction in progress
+  nameIndex_ = 0;
+  nameIndexCount_ = 0;
+  compactRead_ = 0;
+  compactTail_ = false;
+
+  // no FAT long name entries
+  lfnCount_ = 0;
+
+  // start seeks near end of file if the volume remembers its last cluster
+  endCluster_ = 0;
+  if (fileSize_ && isFile()) {
+    endIndex_ = (fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9);
+    vol_->endClusterGet(dirBlock_, dirIndex_, firstCluster_, &endIndex_,
+                        &endCluster_);
+  }
+
+  // truncate file to zero length if requested
+  if (oflag & O_TRUNC) return truncate(0);
   return true;
 }
 //------------------------------------------------------------------------------
-/** %Print the name field of a directory entry in 8.3 format to Serial.
- *
+// open or create a file in an exFAT directory, see open()
+uint8_t SdFile::openExFat(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+  uint8_t length;
+  uint16_t hash;
+
+  if (!makeExFatName(fileName, &length, &hash)) return false;
+  vol_ = dirFile->vol_;
+  dirFile->rewind();
+
+  // entries needed for file, stream and name entries
+  uint8_t need = 2 + (length + 14)/15;
+
+  // run of free entries for a new entry set
+  uint8_t freeCount = 0;
+  uint32_t freePos = 0;
+
+  // search for file
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint32_t pos = dirFile->curPosition_;
+    xdf_t* x = reinterpret_cast<xdf_t*>(dirFile->readDirCache());
+    if (x == NULL) return false;
+
+    if (!(x->type & EXFAT_TYPE_IN_USE)) {
+      // remember first run of free entries that is long enough
+      if (freeCount == 0) freePos = pos;
+      if (freeCount < need) freeCount++;
+
+      // done if no entries follow
+      if (x->type == EXFAT_TYPE_END) {
+        if ((dirFile->fileSize_ - freePos) >= (32UL * need)) freeCount = need;
+        break;
+      }
+      continue;
+    }
+    if (freeCount < need) freeCount = 0;
+    if (x->type != EXFAT_TYPE_FILE) continue;
+
+    // location of entry set
+    dirBlock_ = vol_->cacheBlockNumber_;
+    dirIndex_ = 0XF & (pos >> 5);
+    dirNextBlock_ = dirBlock_;
+    dirCount_ = x->secondaryCount + 1;
+
+    // check stream and name entries
+    uint8_t match = dirCount_ >= need && dirCount_ <= 17;
+    for (uint8_t i = 1; i < dirCount_; i++) {
+      if (dirFile->curPosition_ >= dirFile->fileSize_) return false;
+      uint8_t index = 0XF & (dirFile->curPosition_ >> 5);
+      uint8_t* e = reinterpret_cast<uint8_t*>(dirFile->readDirCache());
+      if (e == NULL) return false;
+      if (index == 0) dirNextBlock_ = vol_->cacheBlockNumber_;
+      if (!match) continue;
+      if (i == 1) {
+        xds_t* s = reinterpret_cast<xds_t*>(e);
+        match = s->type == EXFAT_TYPE_STREAM
+                && s->nameLength == length && s->nameHash == hash;
+      } else if (i < need) {
+        xdn_t* n = reinterpret_cast<xdn_t*>(e);
+        if (n->type != EXFAT_TYPE_NAME) {
+          match = false;
+          continue;
+        }
+        // compare up to 15 characters ignoring case of ASCII letters
+        const char* str = fileName + 15 * (i - 2);
+        for (uint8_t k = 0; k < 15 && str[k]; k++) {
+          uint16_t c = n->name[k];
+          uint8_t u = str[k];
+          if (c >= 'a' && c <= 'z') c += 'A' - 'a';
+          if (u >= 'a' && u <= 'z') u += 'A' - 'a';
+          if (c != u) {
+            match = false;
+            break;
+          }
+        }
+      }
+    }
+    if (match) {
+      // don't open existing file if O_CREAT and O_EXCL
+      if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+
+      // open found file
+      return openCachedSet(oflag);
+    }
+  }
+  // only create file if O_CREAT and O_WRITE
+  if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
+
+  if (freeCount < need) {
+    // a free run that is too short can only be at the end of the directory
+    if (freeCount == 0) freePos = dirFile->fileSize_;
+
+    // add and zero cluster for dirFile
+    if (!dirFile->seekSet(dirFile->fileSize_)) return false;
+    if (!dirFile->addDirCluster()) return false;
+
+    // update directory size in its entry
+    if (!dirFile->sync()) return false;
+
+    // curCluster_ is now the new cluster, seek from the start of dirFile
+    dirFile->rewind();
+  }
+  // build new entry set
+  if (!dirFile->seekSet(freePos)) return false;
+  if (!vol_->writeBegin()) return false;
+  for (uint8_t i = 0; i < need; i++) {
+    uint8_t index = 0XF & (dirFile->curPosition_ >> 5);
+    uint8_t* e = reinterpret_cast<uint8_t*>(dirFile->readDirCache());
+    if (e == NULL) return false;
+    vol_->cacheSetDirty();
+    if (i == 0) {
+      dirBlock_ = vol_->cacheBlockNumber_;
+      dirIndex_ = index;
+      dirNextBlock_ = dirBlock_;
+    } else if (index == 0) {
+      dirNextBlock_ = vol_->cacheBlockNumber_;
+    }
+    memset(e, 0, 32);
+    if (i == 0) {
+      xdf_t* x = reinterpret_cast<xdf_t*>(e);
+      x->type = EXFAT_TYPE_FILE;
+      x->secondaryCount = need - 1;
+      x->attributes = DIR_ATT_ARCHIVE;
+
+      // set timestamps
+      uint16_t date = FAT_DEFAULT_DATE;
+      uint16_t time = FAT_DEFAULT_TIME;
+      if (dateTime_) dateTime_(&date, &time);
+      x->createTimestamp = (uint32_t)date << 16 | time;
+      x->modifyTimestamp = x->createTimestamp;
+      x->accessTimestamp = x->createTimestamp;
+    } else if (i == 1) {
+      xds_t* s = reinterpret_cast<xds_t*>(e);
+      s->type = EXFAT_TYPE_STREAM;
+      s->flags = EXFAT_FLAG_ALLOC_POSSIBLE;
+      s->nameLength = length;
+      s->nameHash = hash;
+    } else {
+      xdn_t* n = reinterpret_cast<xdn_t*>(e);
+      n->type = EXFAT_TYPE_NAME;
+      const char* str = fileName + 15 * (i - 2);
+      for (uint8_t k = 0; k < 15 && str[k]; k++) n->name[k] = str[k];
+    }
+  }
+  dirCount_ = need;
+
+  // new file is empty
+  flags_ = 0;
+  firstCluster_ = 0;
+  fileSize_ = 0;
+
+  // write set checksum and force write of entry set to SD
+  if (!syncSet()) return false;
+  if (!vol_->cacheSync()) return false;
+
+  // open entry set in cache
+  return openCachedSet(oflag);
+}
+//------------------------------------------------------------------------------
+// character of a long name in its 8.3 alias, zero if it is skipped
+static uint8_t lfnAliasChar(uint8_t c) {
+  if (c == ' ' || c == '.') return 0;
+  if (c >= 'a' && c <= 'z') return c - ('a' - 'A');
+  // characters allowed in a long name but not in an 8.3 name
+  char p[8] = {"+,;=[]^"};
+  char *ptr = p;
+  uint8_t b;
+  while ((b = *(ptr++)))
+    if (b == c)
+      return '_';
+  return c;
+}
+//------------------------------------------------------------------------------
+// make the 8.3 alias BASIS~1.EXT for a long name, return index of '~'
+static uint8_t lfnAlias(const char* str, uint8_t* name) {
+  // extension follows the last dot, a leading dot does not start one
+  const char* dot = 0;
+  for (const char* s = str + 1; *s; s++) {
+    if (*s == '.') dot = s;
+  }
+  uint8_t i;
+  for (i = 0; i < 11; i++) name[i] = ' ';
+  i = 0;
+  for (const char* s = str; *s && s != dot && i < 6; s++) {
+    uint8_t c = lfnAliasChar(*s);
+    if (c) name[i++] = c;
+  }
+  if (i == 0) name[i++] = '_';
+  name[i] = '~';
+  name[i + 1] = '1';
+  if (dot) {
+    uint8_t j = 8;
+    for (const char* s = dot + 1; *s && j < 11; s++) {
+      uint8_t c = lfnAliasChar(*s);
+      if (c) name[j++] = c;
+    }
+  }
+  return i;
+}
+//------------------------------------------------------------------------------
+// compare the part of a long name in l with the same part of name,
+// case is ignored for ASCII letters
+static uint8_t lfnCompare(const ldir_t* l, const char* name, uint16_t length) {
+  uint16_t k = ((l->ord & 0X1F) - 1) * LDIR_NAME_CHARS;
+  for (uint8_t i = 0; i < LDIR_NAME_CHARS; i++, k++) {
+    uint16_t c = lfnChar(l, i);
+    if (k == length) return c == 0;
+    uint8_t n = name[k];
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    if (n >= 'a' && n <= 'z') n -= 'a' - 'A';
+    if (c != n) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Replace the basis of an alias with four hex digits of a hash of the long
+// name, used when tails ~1 to ~9 are taken.  Other hash values are tried
+// until the alias is not found in dirFile.
+static uint8_t lfnAliasHash(SdFile* dirFile, const char* str,
+                            uint8_t* alias, uint8_t tilde) {
+  uint16_t h = 0;
+  while (*str) h = 31 * h + *str++;
+  uint8_t k = tilde < 2 ? tilde : 2;
+  for (uint8_t n = 0; n < 100; n++, h++) {
+    for (uint8_t i = 0; i < 4; i++) {
+      uint8_t d = (h >> (12 - 4 * i)) & 0XF;
+      alias[k + i] = d < 10 ? '0' + d : 'A' + d - 10;
+    }
+    alias[k + 4] = '~';
+    alias[k + 5] = '1';
+    for (uint8_t i = k + 6; i < 8; i++) alias[i] = ' ';
+
+    // open by the 8.3 name fails if the alias is not in use
+    dir_t d;
+    char name[13];
+    memcpy(d.name, alias, 11);
+    SdFile::dirName(d, name);
+    SdFile file;
+    if (!file.open(dirFile, name, O_READ)) return true;
+    file.close();
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+// Open or create a file with a long name in a FAT16 or FAT32 directory.
+// The characters of a long name are only compared with fileName if the
+// number of entries fits the length of fileName and the checksums in the
+// entries agree.  The short name checksum is checked last.
+uint8_t SdFile::openLfn(SdFile* dirFile, const char* fileName, uint8_t oflag) {
+  uint16_t length = 0;
+  uint8_t c = 0;
+  for (const char* s = fileName; *s; s++) {
+    c = *s;
+    // illegal long name characters
+    char p[10] = {"\"*/:<>?\\|"};
+    char *ptr = p;
+    uint8_t b;
+    while ((b = *(ptr++)))
+      if (b == c)
+        return false;
+    // only ASCII printable characters
+    if (length == LFN_NAME_MAX || c < 0X20 || c > 0X7E) return false;
+    length++;
+  }
+  // trailing dots and spaces are not allowed
+  if (length == 0 || c == ' ' || c == '.') return false;
+
+  // number of long name entries, the short name entry follows them
+  uint8_t need = (length + LDIR_NAME_CHARS - 1) / LDIR_NAME_CHARS;
+
+  vol_ = dirFile->vol_;
+  dirFile->rewind();
+
+  // alias with tail ~1 and the tails in use for its basis
+  uint8_t alias[11];
+  uint8_t tilde = lfnAlias(fileName, alias);
+  uint16_t tails = 0;
+
+  // first run of need + 1 free entries
+  uint32_t freeSlot = 0;
+  uint8_t freeCount = 0;
+
+  // ord of the last long name entry read, zero if none
+  uint8_t ord = 0;
+  uint8_t sum = 0;
+  uint8_t match = false;
+
+  // search for file
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    uint32_t slot = dirFile->curPosition_ >> 5;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) return false;
+
+    if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED) {
+      ord = 0;
+      if (freeCount == 0) freeSlot = slot;
+      if (freeCount <= need) freeCount++;
+
+      // done if no entries follow
+      if (p->name[0] == DIR_NAME_FREE) break;
+      continue;
+    }
+    if (freeCount <= need) freeCount = 0;
+
+    if (DIR_IS_LONG_NAME(p)) {
+      ldir_t* l = reinterpret_cast<ldir_t*>(p);
+      if (l->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        ord = l->ord & 0X1F;
+        sum = l->checksum;
+        lfnBlock_ = vol_->cacheBlockNumber_;
+        lfnIndex_ = 0XF & slot;
+
+        // the number of entries must fit the length of the name
+        match = ord == need;
+      } else if (ord > 1 && l->ord == (ord - 1) && l->checksum == sum) {
+        ord--;
+      } else {
+        ord = 0;
+      }
+      if (match && ord) match = lfnCompare(l, fileName, length);
+      continue;
+    }
+    if (DIR_IS_FILE_OR_SUBDIR(p)) {
+      if (ord == 1 && match && lfnChecksum(p->name) == sum) {
+        // don't open existing file if O_CREAT and O_EXCL
+        if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+        lfnCount_ = need;
+        return openCachedEntry(0XF & slot, oflag);
+      }
+      // remember the tails of aliases with the same basis and extension
+      uint8_t t = p->name[tilde + 1] - '0';
+      if (p->name[tilde] == '~' && t >= 1 && t <= 9
+        && !memcmp(p->name, alias, tilde)
+        && !memcmp(p->name + tilde + 2, alias + tilde + 2, 9 - tilde)) {
+        tails |= 1 << t;
+      }
+    }
+    ord = 0;
+  }
+  // only create file if O_CREAT and O_WRITE
+  if ((oflag & (O_CREAT | O_WRITE)) != (O_CREAT | O_WRITE)) return false;
+
+  // use the first free tail ~1 to ~9
+  uint8_t t = 1;
+  while (t <= 9 && (tails & (1 << t))) t++;
+  if (t <= 9) {
+    alias[tilde + 1] = '0' + t;
+  } else if (!lfnAliasHash(dirFile, fileName, alias, tilde)) {
+    return false;
+  }
+  if (freeCount <= need) {
+    // the entries go at the end of the directory
+    if (freeCount == 0) freeSlot = dirFile->fileSize_ >> 5;
+    while (((dirFile->fileSize_ >> 5) - freeSlot) <= need) {
+      if (dirFile->type_ == FAT_FILE_TYPE_ROOT16) return false;
+      // add and zero cluster for dirFile after its last cluster
+      uint32_t end = dirFile->fileSize_ >> 5;
+      if (!dirFile->seekSet(dirFile->fileSize_)) return false;
+      if (!dirFile->addDirCluster()) return false;
+      dirFile->nameIndexGrow(end);
+
+      // curCluster_ is now the new cluster, seek from the start of dirFile
+      dirFile->rewind();
+    }
+  }
+  // write long name entries in reverse order then the short name entry
+  sum = lfnChecksum(alias);
+  for (uint8_t i = 0; i <= need; i++) {
+    if (!dirFile->seekSet(32UL * (freeSlot + i))) return false;
+    dir_t* p = dirFile->readDirCache();
+    if (p == NULL) return false;
+    if (!vol_->cacheRawBlock(vol_->cacheBlockNumber_, SdVolume::CACHE_FOR_WRITE)) {
+      return false;
+    }
+    if (i == need) {
+      dirBlock_ = vol_->cacheBlockNumber_;
+      dirIndex_ = 0XF & (freeSlot + i);
+      dirEntryInit(p, alias);
+    } else {
+      if (i == 0) {
+        lfnBlock_ = vol_->cacheBlockNumber_;
+        lfnIndex_ = 0XF & freeSlot;
+      }
+      ldir_t* l = reinterpret_cast<ldir_t*>(p);
+      ord = need - i;
+      memset(l, 0, sizeof(ldir_t));
+      l->ord = i == 0 ? ord | LDIR_ORD_LAST_LONG_ENTRY : ord;
+      l->attributes = DIR_ATT_LONG_NAME;
+      l->checksum = sum;
+      uint16_t k = (ord - 1) * LDIR_NAME_CHARS;
+      for (uint8_t j = 0; j < LDIR_NAME_CHARS; j++, k++) {
+        // name is followed by a zero and padded with 0XFFFF
+        lfnCharPut(l, j, k < length ? fileName[k] : k == length ? 0 : 0XFFFF);
+      }
+    }
+    dirFile->nameIndexPut(freeSlot + i, nameHash(p->name));
+  }
+  lfnCount_ = need;
+
+  // force write of entries to SD
+  if (!vol_->cacheSync()) return false;
+
+  // the new entries may be in the part of dirFile that is being compacted
+  dirFile->compactRead_ = 0;
+  dirFile->compactTail_ = false;
+
+  // open entry in cache
+  return openCachedEntry(dirIndex_, oflag);
+}
+//------------------------------------------------------------------------------
+/**
+ * Open a volume's root directory.
+ *
+ * \param[in] vol The FAT volume containing the root directory to be opened.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the FAT volume has not been initialized
+ * or it a FAT12 volume.
+ */
+uint8_t SdFile::openRoot(SdVolume* vol) {
+  // error if file is already open
+  if (isOpen()) return false;
+
+  if (vol->fatType() == 16) {
+    type_ = FAT_FILE_TYPE_ROOT16;
+    firstCluster_ = 0;
+    fileSize_ = 32 * vol->rootDirEntryCount();
+  } else if (vol->fatType() == 32 || vol->fatType() == FAT_TYPE_EXFAT) {
+    type_ = FAT_FILE_TYPE_ROOT32;
+    firstCluster_ = vol->rootDirStart();
+    if (!vol->chainSize(firstCluster_, &fileSize_)) return false;
+  } else {
+    // volume is not initialized or FAT12
+    return false;
+  }
+  vol_ = vol;
+  // read only
+  flags_ = O_READ;
+
+  // set to start of file
+  curCluster_ = 0;
+  curPosition_ = 0;
+
+  // no extent cache
+  extent_ = 0;
+
+  // no write buffer
+  wbuf_ = 0;
+  wbufCount_ = 0;
+
+  // no name index or compaction in progress
+  nameIndex_ = 0;
+  nameIndexCount_ = 0;
+  compactRead_ = 0;
+  compactTail_ = false;
+
+  // no FAT long name entries
+  lfnCount_ = 0;
+
+  // no end of file cluster
+  endCluster_ = 0;
+
+  // root has no directory entry
+  dirBlock_ = 0;
+  dirIndex_ = 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+/** %Print the name field of a directory entry in 8.3 format to Serial.
+ *
  * \param[in] dir The directory structure containing the name.
  * \param[in] width Blank fill name if length is less than \a width.
  */
@@ -638,6 +1834,122 @@ void SdFile::printFatTime(uint16_t fatTime) {
   printTwoDigits(FAT_SECOND(fatTime));
 }
 //------------------------------------------------------------------------------
+// format n as decimal digits that end at str, return the first digit
+static char* fmtDec(unsigned long n, char* str) {
+  do {
+    unsigned long q = n / 10;
+    *--str = '0' + (n - 10 * q);
+    n = q;
+  } while (n);
+  return str;
+}
+//------------------------------------------------------------------------------
+// put the field terminator at the end of a format buffer
+static char* fmtTerm(char term, char* str) {
+  if (term) {
+    *--str = term;
+    if (term == '\n') *--str = '\r';
+  }
+  return str;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a number and a field terminator to a file with one write().
+ *
+ * Print::print() passes each character of a number to write(uint8_t).
+ * printField() formats the number in a local buffer instead so the cluster
+ * and cache checks in write() are done once for the field.
+ *
+ * \param[in] value The value to be written.
+ *
+ * \param[in] term The character written after the value, typically ',' or
+ * '\\n'.  A '\\n' is written as CR LF.  No terminator is written if
+ * \a term is zero.
+ *
+ * \return The number of bytes written or -1 if an error occurs.
+ */
+int16_t SdFile::printField(long value, char term) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* str = fmtTerm(term, end);
+  if (value < 0) {
+    str = fmtDec(-(unsigned long)value, str);
+    *--str = '-';
+  } else {
+    str = fmtDec(value, str);
+  }
+  return write(str, end - str);
+}
+//------------------------------------------------------------------------------
+/**
+ * Write an unsigned number and a field terminator to a file with one
+ * write().  See printField(long, char).
+ *
+ * \param[in] value The value to be written.
+ *
+ * \param[in] term The character written after the value.
+ *
+ * \return The number of bytes written or -1 if an error occurs.
+ */
+int16_t SdFile::printField(unsigned long value, char term) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* str = fmtDec(value, fmtTerm(term, end));
+  return write(str, end - str);
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a floating point number and a field terminator to a file with
+ * one write().  See printField(long, char).
+ *
+ * Values too large for an unsigned long are written as "ovf" and a NaN
+ * is written as "nan", as Print::print() does.
+ *
+ * \param[in] value The value to be written.
+ *
+ * \param[in] term The character written after the value.
+ *
+ * \param[in] prec Number of digits after the decimal point, at most 9.
+ *
+ * \return The number of bytes written or -1 if an error occurs.
+ */
+int16_t SdFile::printField(double value, char term, uint8_t prec) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* str = fmtTerm(term, end);
+  uint8_t neg = value < 0;
+  if (neg) value = -value;
+  if (prec > 9) prec = 9;
+  unsigned long scale = 1;
+  for (uint8_t i = 0; i < prec; i++) scale *= 10;
+  value += 0.5 / scale;
+  if (value != value) {
+    neg = false;
+    *--str = 'n';
+    *--str = 'a';
+    *--str = 'n';
+  } else if (value >= 4294967040.0) {
+    // same limit as Print
+    neg = false;
+    *--str = 'f';
+    *--str = 'v';
+    *--str = 'o';
+  } else {
+    unsigned long whole = value;
+    unsigned long frac = (value - whole) * scale;
+    if (frac >= scale) frac = scale - 1;
+    for (uint8_t i = 0; i < prec; i++) {
+      unsigned long q = frac / 10;
+      *--str = '0' + (frac - 10 * q);
+      frac = q;
+    }
+    if (prec) *--str = '.';
+    str = fmtDec(whole, str);
+  }
+  if (neg) *--str = '-';
+  return write(str, end - str);
+}
+//------------------------------------------------------------------------------
 /** %Print a value as two digits to Serial.
  *
  * \param[in] v Value to be printed, 0 <= \a v <= 99
@@ -670,14 +1982,30 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   // error if not open or write only
   if (!isOpen() || !(flags_ & O_READ)) return -1;
 
+  // buffered writes must be on the card before they can be read back
+  if (!writeFlush()) return -1;
+
   // max bytes left in file
   if (nbyte > (fileSize_ - curPosition_)) nbyte = fileSize_ - curPosition_;
 
+  // O_DIRECT reads start on a block boundary and end on one or at end of file
+  if ((flags_ & F_FILE_DIRECT) && ((curPosition_ & 0X1FF) ||
+    ((nbyte & 0X1FF) && nbyte != (fileSize_ - curPosition_)))) return -1;
+
   // amount left to read
   uint16_t toRead = nbyte;
   while (toRead > 0) {
     uint32_t block;  // raw device block number
     uint16_t offset = curPosition_ & 0X1FF;  // offset in block
+    if (offset == 0 && toRead >= 512 && type_ != FAT_FILE_TYPE_ROOT16 &&
+      (advice_ != ADVISE_RANDOM || (flags_ & F_FILE_DIRECT))) {
+      // whole blocks go to the caller with one multiple block read per run
+      uint32_t count;
+      if (!readRun(dst, toRead >> 9, &count)) return -1;
+      dst += count << 9;
+      toRead -= count << 9;
+      continue;
+    }
     if (type_ == FAT_FILE_TYPE_ROOT16) {
       block = vol_->rootDirStart() + (curPosition_ >> 9);
     } else {
@@ -687,9 +2015,15 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
+          extentPut(0, curCluster_);
         } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
+          uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+
+          // get next cluster from extent cache or FAT
+          if (!extentGet(index, &curCluster_)) {
+            if (!nextCluster(curCluster_, &curCluster_)) return -1;
+            extentPut(index, curCluster_);
+          }
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
@@ -699,15 +2033,21 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     // amount to be read from current block
     if (n > (512 - offset)) n = 512 - offset;
 
-    // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
+    // no buffering needed if n == 512 or user requests no buffering,
+    // keep whole blocks of a random access file and don't replace the
+    // cached block for a file that is read once or opened with O_DIRECT.
+    // A partial block of a file that is read once only goes to the card
+    // if the card can read it without reading the whole block each time.
+    uint8_t noReuse = advice_ == ADVISE_NOREUSE && vol_->sdCard()->partialBlockRead();
+    if ((unbufferedRead() || noReuse || (flags_ & F_FILE_DIRECT) ||
+      (n == 512 && advice_ != ADVISE_RANDOM)) &&
+      block != vol_->cacheBlockNumber_) {
       if (!vol_->readData(block, offset, n, dst)) return -1;
       dst += n;
     } else {
       // read block to cache and copy data to caller
-      if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
+      if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
+      uint8_t* src = vol_->cacheBuffer_.data + offset;
       uint8_t* end = src + n;
       while (src != end) *dst++ = *src++;
     }
@@ -717,29 +2057,127 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   return nbyte;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read data from a file starting at the current position.
+ *
+ * Same as read(void*, uint16_t) but \a nbyte may be larger than 32 KB.
+ * Whole blocks are moved directly between the card and \a buf with one
+ * multiple block read for each run of contiguous clusters.
+ *
+ * \param[out] buf Pointer to the location that will receive the data.
+ *
+ * \param[in] nbyte Maximum number of bytes to read.
+ *
+ * \return For success read32() returns the number of bytes read.
+ * A value less than \a nbyte, including zero, will be returned
+ * if end of file is reached.
+ * If an error occurs, read32() returns -1.  Possible errors include
+ * read32() called before a file has been opened, corrupt file system
+ * or an I/O error occurred.
+ */
+int32_t SdFile::read32(void* buf, size_t nbyte) {
+  uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+
+  // error if not open or write only
+  if (!isOpen() || !(flags_ & O_READ)) return -1;
+
+  // buffered writes must be on the card before they can be read back
+  if (!writeFlush()) return -1;
+
+  // max bytes left in file
+  if (nbyte > (fileSize_ - curPosition_)) nbyte = fileSize_ - curPosition_;
+  if (nbyte > 0X7FFFFFFF) nbyte = 0X7FFFFFFF;
+
+  // O_DIRECT reads start on a block boundary and end on one or at end of file
+  if ((flags_ & F_FILE_DIRECT) && ((curPosition_ & 0X1FF) ||
+    ((nbyte & 0X1FF) && nbyte != (fileSize_ - curPosition_)))) return -1;
+
+  // amount left to read
+  size_t toRead = nbyte;
+  while (toRead > 0) {
+    uint16_t offset = curPosition_ & 0X1FF;
+    if (offset || toRead < 512 || type_ == FAT_FILE_TYPE_ROOT16 ||
+      (advice_ == ADVISE_RANDOM && !(flags_ & F_FILE_DIRECT))) {
+      // partial block or a file that uses the cache, stop at block boundary
+      uint16_t n = offset ? 512 - offset : 0X4000;
+      if (n > toRead) n = toRead;
+      if (read(dst, n) != n) return -1;
+      dst += n;
+      toRead -= n;
+      continue;
+    }
+    // whole blocks
+    uint32_t count;
+    if (!readRun(dst, toRead >> 9, &count)) return -1;
+    dst += count << 9;
+    toRead -= count << 9;
+  }
+  return nbyte;
+}
+//------------------------------------------------------------------------------
 /**
  * Read the next directory entry from a directory file.
  *
  * \param[out] dir The dir_t struct that will receive the data.
+ * \param[out] longName If not null, receives the long name of the entry,
+ * or an empty string if the entry has no valid long name.  Characters
+ * that are not ASCII are replaced by '?'.
+ * \param[in] size Size of \a longName, a long name that does not fit
+ * is truncated.
  *
  * \return For success readDir() returns the number of bytes read.
  * A value of zero will be returned if end of file is reached.
  * If an error occurs, readDir() returns -1.  Possible errors include
  * readDir() called before a directory has been opened, this is not
- * a directory file or an I/O error occurred.
+ * a directory file, the directory is on an exFAT volume or an I/O
+ * error occurred.
  */
-int8_t SdFile::readDir(dir_t* dir) {
+int8_t SdFile::readDir(dir_t* dir, char* longName, uint16_t size) {
   int8_t n;
   // if not a directory file or miss-positioned return an error
   if (!isDir() || (0X1F & curPosition_)) return -1;
 
+  // exFAT entries are not dir_t entries
+  if (vol_->fatType() == FAT_TYPE_EXFAT) return -1;
+
+  if (size == 0) longName = 0;
+  if (longName) longName[0] = 0;
+
+  // ord of the last long name entry read, zero if none
+  uint8_t ord = 0;
+  uint8_t sum = 0;
+
   while ((n = read(dir, sizeof(dir_t))) == sizeof(dir_t)) {
     // last entry if DIR_NAME_FREE
     if (dir->name[0] == DIR_NAME_FREE) break;
     // skip empty entries and entry for .  and ..
-    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.') continue;
+    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.') {
+      ord = 0;
+      continue;
+    }
+    if (DIR_IS_LONG_NAME(dir)) {
+      if (!longName) continue;
+      ldir_t* l = reinterpret_cast<ldir_t*>(dir);
+      if (l->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        ord = l->ord & 0X1F;
+        sum = l->checksum;
+        lfnTerminate(l, longName, size);
+      } else if (ord > 1 && l->ord == (ord - 1) && l->checksum == sum) {
+        ord--;
+      } else {
+        ord = 0;
+      }
+      if (ord) lfnGet(l, longName, size);
+      continue;
+    }
     // return if normal file or subdirectory
-    if (DIR_IS_FILE_OR_SUBDIR(dir)) return n;
+    if (DIR_IS_FILE_OR_SUBDIR(dir)) {
+      if (longName && (ord != 1 || lfnChecksum(dir->name) != sum)) {
+        longName[0] = 0;
+      }
+      return n;
+    }
+    ord = 0;
   }
   // error, end of file, or past last entry
   return n < 0 ? -1 : 0;
@@ -761,7 +2199,49 @@ dir_t* SdFile::readDirCache(void) {
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (vol_->cacheBuffer_.dir + i);
+}
+//------------------------------------------------------------------------------
+// Read up to want whole blocks at the current position, which must be
+// at a block boundary, with one multiple block read for the run of
+// contiguous clusters at the position.  *count is set to the number of
+// blocks read.
+uint8_t SdFile::readRun(uint8_t* dst, uint32_t want, uint32_t* count) {
+  uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+  if (blockOfCluster == 0) {
+    // start of new cluster
+    if (curPosition_ == 0) {
+      curCluster_ = firstCluster_;
+      extentPut(0, curCluster_);
+    } else if (!extentGet(curPosition_ >> shift, &curCluster_)) {
+      if (!nextCluster(curCluster_, &curCluster_)) return false;
+      extentPut(curPosition_ >> shift, curCluster_);
+    }
+  }
+  uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  uint32_t n = vol_->blocksPerCluster_ - blockOfCluster;
+
+  // extend the run while the next cluster follows the last one
+  uint32_t c = curCluster_;
+  while (n < want) {
+    uint32_t index = (curPosition_ + (n << 9)) >> shift;
+    uint32_t next;
+    if (!extentGet(index, &next)) {
+      if (!nextCluster(c, &next) || vol_->isEOC(next)) return false;
+      extentPut(index, next);
+    }
+    if (next != (c + 1)) break;
+    c = next;
+    n += vol_->blocksPerCluster_;
+  }
+  if (n > want) n = want;
+  if (!vol_->readBlocks(block, n, dst)) return false;
+
+  curCluster_ = c;
+  curPosition_ += n << 9;
+  *count = n;
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -782,18 +2262,36 @@ uint8_t SdFile::remove(void) {
   // free any clusters - will fail if read-only or directory
   if (!truncate(0)) return false;
 
-  // cache directory entry
-  dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
-  if (!d) return false;
+  if (vol_->fatType() == FAT_TYPE_EXFAT) {
+    // mark all entries of the set deleted
+    for (uint8_t i = 0; i < dirCount_; i++) {
+      dir_t* d = cacheSetEntry(i, SdVolume::CACHE_FOR_WRITE);
+      if (!d) return false;
+      d->name[0] &= ~EXFAT_TYPE_IN_USE;
+    }
+  } else {
+    // cache directory entry
+    dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
+    if (!d) return false;
 
-  // mark entry deleted
-  d->name[0] = DIR_NAME_DELETED;
+    // mark entry deleted
+    d->name[0] = DIR_NAME_DELETED;
+
+    // mark long name entries deleted
+    uint32_t block = lfnBlock_;
+    uint8_t index = lfnIndex_;
+    for (uint8_t i = 0; i < lfnCount_; i++) {
+      if (i && !lfnNext(&block, &index)) return false;
+      if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
+      vol_->cacheBuffer_.dir[index].name[0] = DIR_NAME_DELETED;
+    }
+  }
 
   // set this SdFile closed
   type_ = FAT_FILE_TYPE_CLOSED;
 
   // write entry to SD
-  return SdVolume::cacheFlush();
+  return vol_->cacheSync();
 }
 //------------------------------------------------------------------------------
 /**
@@ -817,7 +2315,17 @@ uint8_t SdFile::remove(void) {
 uint8_t SdFile::remove(SdFile* dirFile, const char* fileName) {
   SdFile file;
   if (!file.open(dirFile, fileName, O_WRITE)) return false;
-  return file.remove();
+
+  // open() leaves dirFile positioned after the file's entry
+  uint32_t slot = (dirFile->curPosition_ >> 5) - 1;
+  uint8_t n = file.lfnCount_;
+  if (!file.remove()) return false;
+
+  // free the short name entry and any long name entries before it
+  do {
+    dirFile->nameIndexPut(slot--, 0);
+  } while (n--);
+  return true;
 }
 //------------------------------------------------------------------------------
 /** Remove a directory file.
@@ -845,6 +2353,12 @@ uint8_t SdFile::rmDir(void) {
   while (curPosition_ < fileSize_) {
     dir_t* p = readDirCache();
     if (p == NULL) return false;
+    if (vol_->fatType() == FAT_TYPE_EXFAT) {
+      // exFAT directory has no '.' or '..' entries
+      if (p->name[0] == EXFAT_TYPE_END) break;
+      if (p->name[0] & EXFAT_TYPE_IN_USE) return false;
+      continue;
+    }
     // done if past last used entry
     if (p->name[0] == DIR_NAME_FREE) break;
     // skip empty slot or '.' or '..'
@@ -872,8 +2386,11 @@ uint8_t SdFile::rmDir(void) {
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
+ * Not available for exFAT directories.
  */
 uint8_t SdFile::rmRfStar(void) {
+  if (vol_->fatType() == FAT_TYPE_EXFAT) return false;
+
   rewind();
   while (curPosition_ < fileSize_) {
     SdFile f;
@@ -921,6 +2438,9 @@ uint8_t SdFile::rmRfStar(void) {
  * the value zero, false, is returned for failure.
  */
 uint8_t SdFile::seekSet(uint32_t pos) {
+  // curCluster_ is not advanced for buffered writes
+  if (!writeFlush()) return false;
+
   // error if file not open or seek past end of file
   if (!isOpen() || pos > fileSize_) return false;
 
@@ -938,20 +2458,144 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
+  if (flags_ & F_FILE_CONTIGUOUS) {
+    // exFAT file with no FAT chain
+    curCluster_ = firstCluster_ + nNew;
+    curPosition_ = pos;
+    return true;
+  }
+
+  // no chain walk if new cluster is in the extent cache
+  if (extentGet(nNew, &curCluster_)) {
+    curPosition_ = pos;
+    return true;
+  }
   if (nNew < nCur || curPosition_ == 0) {
     // must follow chain from first cluster
     curCluster_ = firstCluster_;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
+    nCur = 0;
+    extentPut(0, curCluster_);
+  }
+  if (extentCount()) {
+    // advance from end of extent cache if it is past curPosition
+    extent_t* e = extent_ + extentCount_ - 1;
+    uint32_t n = e->fileCluster + e->length - 1;
+    if (n > nCur) {
+      nCur = n;
+      curCluster_ = e->diskCluster + e->length - 1;
+    }
+  }
+  if (endCluster_ && nCur < endIndex_ && endIndex_ <= nNew) {
+    // advance from the remembered end of file cluster
+    nCur = endIndex_;
+    curCluster_ = endCluster_;
+  }
+  if (!extent_ && nCur < nNew) {
+    // follow chain in one pass if there is no extent cache to fill
+    uint32_t n = nNew - nCur;
+    if (!vol_->fatFollow(&curCluster_, &n, SdVolume::CACHE_FOR_READ)) return false;
+    if (n != (nNew - nCur)) return false;
+    nCur = nNew;
   }
-  while (nNew--) {
+  while (nCur < nNew) {
     if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+    extentPut(++nCur, curCluster_);
   }
   curPosition_ = pos;
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Use a caller supplied array to cache the cluster runs of this file.
+ *
+ * seekSet(), read() and write() look up clusters in the extent cache
+ * before following the FAT chain.  The cache is filled as the chain is
+ * followed so a call to seekEnd() fills it in one pass.  Clusters past
+ * the last cached extent are found by following the chain from the end
+ * of the cache.
+ *
+ * The extent cache is cleared when the file is opened.
+ *
+ * \param[in] cache Array that will hold the extents.
+ *
+ * \param[in] size Number of entries in \a cache.
+ */
+void SdFile::setExtentCache(extent_t* cache, uint8_t size) {
+  extent_ = size ? cache : 0;
+  extentMax_ = size;
+  extentCount_ = 0;
+}
+//------------------------------------------------------------------------------
+/**
+ * Use a caller supplied array to index the names in this directory.
+ *
+ * The index holds a 16-bit hash of the name of each directory entry.
+ * open() reads only the directory blocks with entries whose hash matches
+ * the name, and a free entry for a new file is found in the index.
+ * The index is built by the first open() that uses it.  Entries past the
+ * end of the index are searched one block at a time as before.  Use
+ * setExtentCache() for the directory so the seek to an entry does not
+ * follow the FAT chain.
+ *
+ * Files must be created in the directory with this SdFile while the
+ * index is in use.  The index is released when the directory is opened.
+ * Only FAT16 and FAT32 directories use an index.  exFAT entry sets
+ * already hold a name hash.  Long names are not indexed, they are found
+ * by a scan of the directory.
+ *
+ * \param[in] index Array with one element for each directory entry.
+ *
+ * \param[in] size Number of elements in \a index.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include this SdFile is not a directory or the
+ * volume is exFAT.
+ */
+uint8_t SdFile::setNameIndex(uint16_t* index, uint16_t size) {
+  nameIndex_ = 0;
+  nameIndexCount_ = 0;
+  if (!index || !size) return true;
+  if (!isDir() || vol_->fatType() == FAT_TYPE_EXFAT) return false;
+  nameIndex_ = index;
+  nameIndexMax_ = size;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Use a caller supplied buffer to collect data written to this file.
+ *
+ * write() copies data to the buffer instead of the shared cache block.
+ * The buffer is sent to the card with one multiple block write when it
+ * is full or when sync(), close(), seekSet(), read() or truncate() is
+ * called.  Several files written in turn then do not compete for the
+ * cache block.  The buffer is released when the file is opened.
+ *
+ * Buffered data is not on the card and is lost if power fails before
+ * the buffer is flushed.  Use sync() to flush the buffer.
+ *
+ * \param[in] buf Buffer of \a blocks times 512 bytes, or NULL to flush
+ * and release the current buffer.
+ *
+ * \param[in] blocks Size of \a buf in 512 byte blocks.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open for write, the file
+ * was opened with O_DIRECT or an I/O error occurred while flushing the
+ * current buffer.
+ */
+uint8_t SdFile::setWriteBuffer(uint8_t* buf, uint8_t blocks) {
+  if (!writeFlush()) return false;
+  wbuf_ = 0;
+  if (!buf) return true;
+  if (!isFile() || !(flags_ & O_WRITE) || (flags_ & F_FILE_DIRECT) ||
+    blocks == 0) return false;
+  wbuf_ = buf;
+  wbufBlocks_ = blocks;
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * The sync() call causes all modified data and directory fields
  * to be written to the storage device.
@@ -965,26 +2609,83 @@ uint8_t SdFile::sync(void) {
   // only allow open files and directories
   if (!isOpen()) return false;
 
+  // send any buffered writes to the card
+  if (!writeFlush()) return false;
+
+  if (isFile() && !(flags_ & F_FILE_CONTIGUOUS)) {
+    // remember the end of file cluster for the next open of this file
+    if (fileSize_ && curPosition_ == fileSize_) {
+      endIndex_ = (fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9);
+      endCluster_ = curCluster_;
+    }
+    vol_->endClusterPut(dirBlock_, dirIndex_, firstCluster_, endIndex_,
+                        fileSize_ ? endCluster_ : 0);
+  }
   if (flags_ & F_FILE_DIR_DIRTY) {
-    dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
-    if (!d) return false;
+    if (vol_->fatType() == FAT_TYPE_EXFAT) {
+      // exFAT root directory has no entry set
+      if (!isRoot() && !syncSet()) return false;
+    } else {
+      dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
+      if (!d) return false;
 
-    // do not set filesize for dir files
-    if (!isDir()) d->fileSize = fileSize_;
+      // do not set filesize for dir files
+      if (!isDir()) d->fileSize = fileSize_;
 
-    // update first cluster fields
-    d->firstClusterLow = firstCluster_ & 0XFFFF;
-    d->firstClusterHigh = firstCluster_ >> 16;
+      // update first cluster fields
+      d->firstClusterLow = firstCluster_ & 0XFFFF;
+      d->firstClusterHigh = firstCluster_ >> 16;
 
-    // set modify time if user supplied a callback date/time function
-    if (dateTime_) {
-      dateTime_(&d->lastWriteDate, &d->lastWriteTime);
-      d->lastAccessDate = d->lastWriteDate;
+      // set modify time if user supplied a callback date/time function
+      if (dateTime_) {
+        dateTime_(&d->lastWriteDate, &d->lastWriteTime);
+        d->lastAccessDate = d->lastWriteDate;
+      }
     }
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-  return SdVolume::cacheFlush();
+  return vol_->cacheSync();
+}
+//------------------------------------------------------------------------------
+// update the stream entry and set checksum of an exFAT entry set
+uint8_t SdFile::syncSet(void) {
+  xds_t* s = reinterpret_cast<xds_t*>(cacheSetEntry(1, SdVolume::CACHE_FOR_WRITE));
+  if (!s) return false;
+
+  s->flags = EXFAT_FLAG_ALLOC_POSSIBLE;
+  if (firstCluster_ && (flags_ & F_FILE_CONTIGUOUS)) {
+    s->flags |= EXFAT_FLAG_NO_FAT_CHAIN;
+  }
+  s->firstCluster = firstCluster_;
+  s->validDataLength = fileSize_;
+  s->dataLength = fileSize_;
+
+  xdf_t* x = reinterpret_cast<xdf_t*>(cacheSetEntry(0, SdVolume::CACHE_FOR_WRITE));
+  if (!x) return false;
+
+  // set modify time if user supplied a callback date/time function
+  if (dateTime_) {
+    uint16_t date;
+    uint16_t time;
+    dateTime_(&date, &time);
+    x->modifyTimestamp = (uint32_t)date << 16 | time;
+    x->accessTimestamp = x->modifyTimestamp;
+  }
+  // checksum of all bytes in the set except the checksum field
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < dirCount_; i++) {
+    uint8_t* e = reinterpret_cast<uint8_t*>(cacheSetEntry(i, SdVolume::CACHE_FOR_READ));
+    if (!e) return false;
+    for (uint8_t k = 0; k < 32; k++) {
+      if (i == 0 && (k == 2 || k == 3)) continue;
+      sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + e[k];
+    }
+  }
+  x = reinterpret_cast<xdf_t*>(cacheSetEntry(0, SdVolume::CACHE_FOR_WRITE));
+  if (!x) return false;
+  x->setChecksum = sum;
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -1035,11 +2736,31 @@ uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
     || second > 59) {
       return false;
   }
+  uint16_t dirDate = FAT_DATE(year, month, day);
+  uint16_t dirTime = FAT_TIME(hour, minute, second);
+
+  if (vol_->fatType() == FAT_TYPE_EXFAT) {
+    // exFAT root directory has no entry set
+    if (isRoot()) return false;
+
+    xdf_t* x = reinterpret_cast<xdf_t*>(cacheSetEntry(0, SdVolume::CACHE_FOR_WRITE));
+    if (!x) return false;
+
+    uint32_t stamp = (uint32_t)dirDate << 16 | dirTime;
+    if (flags & T_ACCESS) x->accessTimestamp = stamp;
+    if (flags & T_CREATE) {
+      x->createTimestamp = stamp;
+      x->create10ms = second & 1 ? 100 : 0;
+    }
+    if (flags & T_WRITE) x->modifyTimestamp = stamp;
+
+    // sync() updates the set checksum
+    flags_ |= F_FILE_DIR_DIRTY;
+    return sync();
+  }
   dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
   if (!d) return false;
 
-  uint16_t dirDate = FAT_DATE(year, month, day);
-  uint16_t dirTime = FAT_TIME(hour, minute, second);
   if (flags & T_ACCESS) {
     d->lastAccessDate = dirDate;
   }
@@ -1053,7 +2774,7 @@ uint8_t SdFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
     d->lastWriteDate = dirDate;
     d->lastWriteTime = dirTime;
   }
-  SdVolume::cacheSetDirty();
+  vol_->cacheSetDirty();
   return sync();
 }
 //------------------------------------------------------------------------------
@@ -1073,6 +2794,9 @@ uint8_t SdFile::truncate(uint32_t length) {
 // error if not a normal file or read-only
   if (!isFile() || !(flags_ & O_WRITE)) return false;
 
+  // send any buffered writes to the card
+  if (!writeFlush()) return false;
+
   // error if length is greater than current size
   if (length > fileSize_) return false;
 
@@ -1085,22 +2809,40 @@ uint8_t SdFile::truncate(uint32_t length) {
   // position to last cluster in truncated file
   if (!seekSet(length)) return false;
 
+  // clusters of an exFAT file with no FAT chain
+  uint32_t count = ((fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9)) + 1;
+
   if (length == 0) {
     // free all clusters
-    if (!vol_->freeChain(firstCluster_)) return false;
+    if (flags_ & F_FILE_CONTIGUOUS) {
+      if (!vol_->bitmapPut(firstCluster_, count, 0)) return false;
+    } else {
+      if (!vol_->freeChain(firstCluster_)) return false;
+    }
     firstCluster_ = 0;
   } else {
     uint32_t toFree;
-    if (!vol_->fatGet(curCluster_, &toFree)) return false;
+    if (!nextCluster(curCluster_, &toFree)) return false;
 
     if (!vol_->isEOC(toFree)) {
-      // free extra clusters
-      if (!vol_->freeChain(toFree)) return false;
+      if (flags_ & F_FILE_CONTIGUOUS) {
+        // free clusters at end of run
+        if (!vol_->bitmapPut(toFree, firstCluster_ + count - toFree, 0)) return false;
+      } else {
+        // free extra clusters
+        if (!vol_->freeChain(toFree)) return false;
 
-      // current cluster is end of chain
-      if (!vol_->fatPutEOC(curCluster_)) return false;
+        // current cluster is end of chain
+        if (!vol_->fatPutEOC(curCluster_)) return false;
+      }
     }
   }
+  // drop freed clusters from extent cache
+  extentTrim(length ? ((length - 1) >> (vol_->clusterSizeShift_ + 9)) + 1 : 0);
+  if (!length || endIndex_ > ((length - 1) >> (vol_->clusterSizeShift_ + 9))) {
+    endCluster_ = 0;
+  }
+
   fileSize_ = length;
 
   // need to update directory entry
@@ -1132,39 +2874,196 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
   // convert void* to uint8_t*  -  must be before goto statements
   const uint8_t* src = reinterpret_cast<const uint8_t*>(buf);
 
-  // number of bytes left to write  -  must be before goto statements
-  uint16_t nToWrite = nbyte;
-
   // error if not a normal file or is read-only
   if (!isFile() || !(flags_ & O_WRITE)) goto writeErrorReturn;
 
   // seek to end of file if append flag
-  if ((flags_ & O_APPEND) && curPosition_ != fileSize_) {
+  if ((flags_ & O_APPEND) && curPosition_ != fileSize()) {
+    if (!seekEnd()) goto writeErrorReturn;
+  }
+  // O_DIRECT writes are whole blocks at a block boundary
+  if ((flags_ & F_FILE_DIRECT) && ((curPosition_ | nbyte) & 0X1FF)) {
+    goto writeErrorReturn;
+  }
+
+  if (wbuf_ ? !writeBuffer(src, nbyte) : !writeBytes(src, nbyte)) {
+    goto writeErrorReturn;
+  }
+  if (flags_ & O_SYNC) {
+    if (!sync()) goto writeErrorReturn;
+  }
+  return nbyte;
+
+ writeErrorReturn:
+  // return for write error
+  writeError = true;
+  return -1;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a byte to a file. Required by the Arduino Print class.
+ *
+ * Use SdFile::writeError to check for errors.
+ */
+void SdFile::write(uint8_t b) {
+  // fast path for a byte that goes to the write buffer or to the middle
+  // of the file's data block already in the cache
+  if (isFile() && (flags_ & (O_WRITE | O_SYNC)) == O_WRITE &&
+    (!(flags_ & O_APPEND) || curPosition_ >= fileSize_)) {
+    if (wbufCount_ && wbufCount_ < ((uint32_t)wbufBlocks_ << 9)) {
+      wbuf_[wbufCount_++] = b;
+      curPosition_++;
+      return;
+    }
+    uint16_t offset = curPosition_ & 0X1FF;
+    if (offset && !(flags_ & F_FILE_DIRECT) && vol_->cacheDirty_ &&
+      vol_->cacheBlockNumber_ == vol_->clusterStartBlock(curCluster_)
+      + vol_->blockOfCluster(curPosition_)) {
+      vol_->cacheBuffer_.data[offset] = b;
+      if (++curPosition_ > fileSize_) {
+        fileSize_ = curPosition_;
+        flags_ |= F_FILE_DIR_DIRTY;
+      } else if (dateTime_) {
+        flags_ |= F_FILE_DIR_DIRTY;
+      }
+      return;
+    }
+  }
+  write(&b, 1);
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a string to a file. Used by the Arduino Print class.
+ *
+ * Use SdFile::writeError to check for errors.
+ */
+void SdFile::write(const char* str) {
+  write(str, strlen(str));
+}
+//------------------------------------------------------------------------------
+/**
+ * Write data to an open file.
+ *
+ * Same as write(const void*, uint16_t) but \a nbyte may be larger than
+ * 32 KB.  Clusters for each run of whole blocks are added to the file
+ * first, then the blocks are moved directly from \a buf to the card with
+ * one multiple block write for each run of contiguous clusters.
+ *
+ * \param[in] buf Pointer to the location of the data to be written.
+ *
+ * \param[in] nbyte Number of bytes to write.
+ *
+ * \return For success write32() returns the number of bytes written,
+ * always \a nbyte.  If an error occurs, write32() returns -1.  Possible
+ * errors are the same as for write(const void*, uint16_t).
+ */
+int32_t SdFile::write32(const void* buf, size_t nbyte) {
+  // convert void* to uint8_t*  -  must be before goto statements
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(buf);
+
+  // error if not a normal file or is read-only
+  if (!isFile() || !(flags_ & O_WRITE) || nbyte > 0X7FFFFFFF) goto writeErrorReturn;
+
+  // seek to end of file if append flag
+  if ((flags_ & O_APPEND) && curPosition_ != fileSize()) {
     if (!seekEnd()) goto writeErrorReturn;
   }
+  // O_DIRECT writes are whole blocks at a block boundary
+  if ((flags_ & F_FILE_DIRECT) && ((curPosition_ | nbyte) & 0X1FF)) {
+    goto writeErrorReturn;
+  }
+
+  if (wbuf_ ? !writeBuffer(src, nbyte) : !writeBytes(src, nbyte)) {
+    goto writeErrorReturn;
+  }
+  if (flags_ & O_SYNC) {
+    if (!sync()) goto writeErrorReturn;
+  }
+  return nbyte;
 
+ writeErrorReturn:
+  // return for write error
+  writeError = true;
+  return -1;
+}
+//------------------------------------------------------------------------------
+// Copy data to the write buffer.  The buffer starts at a block boundary,
+// a partial block ahead of it goes through the cache.  A full buffer is
+// sent to the card with writeFlush().  Data larger than an empty buffer
+// is written directly from src.
+uint8_t SdFile::writeBuffer(const uint8_t* src, uint32_t nbyte) {
+  uint32_t size = (uint32_t)wbufBlocks_ << 9;
+  while (nbyte > 0) {
+    uint32_t n;
+    if (wbufCount_ == 0) {
+      uint16_t blockOffset = curPosition_ & 0X1FF;
+      if (blockOffset || nbyte >= size) {
+        // finish the partial block or write whole blocks without a copy
+        n = blockOffset ? 512 - blockOffset : nbyte & ~0X1FFUL;
+        if (n > nbyte) n = nbyte;
+        if (!writeBytes(src, n)) return false;
+        src += n;
+        nbyte -= n;
+        continue;
+      }
+      wbufPos_ = curPosition_;
+    }
+    n = size - wbufCount_;
+    if (n > nbyte) n = nbyte;
+    uint8_t* dst = wbuf_ + wbufCount_;
+    uint8_t* end = dst + n;
+    while (dst != end) *dst++ = *src++;
+    nbyte -= n;
+    wbufCount_ += n;
+    curPosition_ += n;
+    if (wbufCount_ == size && !writeFlush()) {
+      // drop this copy so a caller that sends the data again
+      // does not add it to the buffer twice
+      wbufCount_ -= n;
+      curPosition_ -= n;
+      return false;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Write data at the current position.  Whole blocks go to the card with
+// writeRun(), partial blocks go through the cache.
+uint8_t SdFile::writeBytes(const uint8_t* src, uint32_t nbyte) {
+  uint32_t nToWrite = nbyte;
   while (nToWrite > 0) {
     uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
     uint16_t blockOffset = curPosition_ & 0X1FF;
+    if (blockOffset == 0 && nToWrite >= 512) {
+      // whole blocks go to the card with one multiple block write per run
+      uint32_t count;
+      if (!writeRun(src, nToWrite >> 9, &count)) return false;
+      src += count << 9;
+      nToWrite -= count << 9;
+      continue;
+    }
     if (blockOfCluster == 0 && blockOffset == 0) {
       // start of new cluster
       if (curCluster_ == 0) {
         if (firstCluster_ == 0) {
           // allocate first cluster of file
-          if (!addCluster()) goto writeErrorReturn;
+          if (!addCluster()) return false;
         } else {
           curCluster_ = firstCluster_;
         }
-      } else {
+      } else if (!extentGet(curPosition_ >> (vol_->clusterSizeShift_ + 9),
+                            &curCluster_)) {
         uint32_t next;
-        if (!vol_->fatGet(curCluster_, &next)) return false;
+        if (!nextCluster(curCluster_, &next)) return false;
         if (vol_->isEOC(next)) {
           // add cluster if at end of chain
-          if (!addCluster()) goto writeErrorReturn;
+          if (!addCluster()) return false;
         } else {
           curCluster_ = next;
         }
       }
+      // remember new cluster in extent cache
+      extentPut(curPosition_ >> (vol_->clusterSizeShift_ + 9), curCluster_);
     }
     // max space in block
     uint16_t n = 512 - blockOffset;
@@ -1172,32 +3071,22 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
     // lesser of space and amount to write
     if (n > nToWrite) n = nToWrite;
 
-    // block for data write
+    // block for data write, partial blocks use the cache
     uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
-    if (n == 512) {
-      // full block - don't need to use cache
-      // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
-      if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
-      src += 512;
+    if (blockOffset == 0 && curPosition_ >= fileSize_) {
+      // start of new block don't need to read into cache
+      if (!vol_->writeBegin() || !vol_->cacheFlush()) return false;
+      vol_->cacheBlockNumber_ = block;
+      vol_->cacheSetDirty();
     } else {
-      if (blockOffset == 0 && curPosition_ >= fileSize_) {
-        // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
-      } else {
-        // rewrite part of block
-        if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
-          goto writeErrorReturn;
-        }
+      // rewrite part of block
+      if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
+        return false;
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
-      uint8_t* end = dst + n;
-      while (dst != end) *dst++ = *src++;
     }
+    uint8_t* dst = vol_->cacheBuffer_.data + blockOffset;
+    uint8_t* end = dst + n;
+    while (dst != end) *dst++ = *src++;
     nToWrite -= n;
     curPosition_ += n;
   }
@@ -1209,34 +3098,85 @@ int16_t SdFile::write(const void* buf, uint16_t nbyte) {
     // insure sync will update modified date and time
     flags_ |= F_FILE_DIR_DIRTY;
   }
-
-  if (flags_ & O_SYNC) {
-    if (!sync()) goto writeErrorReturn;
-  }
-  return nbyte;
-
- writeErrorReturn:
-  // return for write error
-  writeError = true;
-  return -1;
+  return true;
 }
 //------------------------------------------------------------------------------
-/**
- * Write a byte to a file. Required by the Arduino Print class.
- *
- * Use SdFile::writeError to check for errors.
- */
-void SdFile::write(uint8_t b) {
-  write(&b, 1);
+// Send the contents of the write buffer to the card.  The buffered data
+// starts at wbufPos_ and curCluster_ still belongs to that position.
+uint8_t SdFile::writeFlush(void) {
+  uint32_t n = wbufCount_;
+  if (n == 0) return true;
+  uint32_t pos = curPosition_;
+  uint32_t cluster = curCluster_;
+  curPosition_ = wbufPos_;
+  if (!writeBytes(wbuf_, n)) {
+    // keep the data and position so sync() or close() can try again
+    curPosition_ = pos;
+    curCluster_ = cluster;
+    return false;
+  }
+  wbufCount_ = 0;
+  return true;
 }
 //------------------------------------------------------------------------------
-/**
- * Write a string to a file. Used by the Arduino Print class.
- *
- * Use SdFile::writeError to check for errors.
- */
-void SdFile::write(const char* str) {
-  write(str, strlen(str));
+// Write up to want whole blocks at the current position, which must be
+// at a block boundary.  The clusters for one run of contiguous clusters
+// are found or added first, then the run is sent to the card with one
+// multiple block write.  *count is set to the number of blocks written.
+uint8_t SdFile::writeRun(const uint8_t* src, uint32_t want, uint32_t* count) {
+  uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+  uint8_t shift = vol_->clusterSizeShift_ + 9;
+  if (blockOfCluster == 0) {
+    // start of new cluster
+    if (curCluster_ == 0) {
+      if (firstCluster_ == 0) {
+        // allocate first cluster of file
+        if (!addCluster()) return false;
+      } else {
+        curCluster_ = firstCluster_;
+      }
+    } else if (!extentGet(curPosition_ >> shift, &curCluster_)) {
+      uint32_t next;
+      if (!nextCluster(curCluster_, &next)) return false;
+      if (vol_->isEOC(next)) {
+        // add cluster if at end of chain
+        if (!addCluster()) return false;
+      } else {
+        curCluster_ = next;
+      }
+    }
+    // remember new cluster in extent cache
+    extentPut(curPosition_ >> shift, curCluster_);
+  }
+  uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  uint32_t n = vol_->blocksPerCluster_ - blockOfCluster;
+
+  // find or add the clusters for the run before any data is sent
+  uint32_t c = curCluster_;
+  while (n < want) {
+    uint32_t index = (curPosition_ + (n << 9)) >> shift;
+    uint32_t next;
+    if (!extentGet(index, &next)) {
+      if (!nextCluster(c, &next)) return false;
+      if (vol_->isEOC(next)) {
+        // addCluster() links a new cluster to curCluster_
+        curCluster_ = c;
+        if (!addCluster()) return false;
+        next = curCluster_;
+      }
+      extentPut(index, next);
+    }
+    if (next != (c + 1)) break;
+    c = next;
+    n += vol_->blocksPerCluster_;
+  }
+  if (n > want) n = want;
+  if (!vol_->writeBlocks(block, n, src)) return false;
+
+  curCluster_ = c;
+  curPosition_ += n << 9;
+  *count = n;
+  return true;
 }
 //------------------------------------------------------------------------------
 /**
@@ -41,12 +41,14 @@
 #define CMD9    (0x40 | 9)
 /** SEND_CID - read the card identification information (CID register) */
 #define CMD10   (0x40 | 10)
+/** STOP_TRANSMISSION - end multiple block read sequence */
 #define CMD12   (0x40 | 12)
 /** SEND_STATUS - read the card status register */
 #define CMD13   (0x40 | 13)
 #define CMD16   (0x40 | 16)
 /** READ_BLOCK - read a single data block from the card */
 #define CMD17   (0x40 | 17)
+/** READ_MULTIPLE_BLOCK - read blocks of data until a STOP_TRANSMISSION */
 #define CMD18   (0x40 | 18)
 /** WRITE_BLOCK - write a single data block to the card */
 #define CMD24   (0x40 | 24)
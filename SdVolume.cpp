@@ -2,85 +2,259 @@
 #include <usb_serial.h>
 
 //------------------------------------------------------------------------------
-// raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
-Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
+// first cluster at or after cluster that starts on an allocation unit boundary
+uint32_t SdVolume::allocAlign(uint32_t cluster) const {
+    // allocation unit size in clusters
+    uint32_t auClusters = allocUnitBlocks_ >> clusterSizeShift_;
+
+    // no alignment if unit is not a multiple of cluster size
+    if (auClusters < 2 || (auClusters << clusterSizeShift_) != allocUnitBlocks_)
+        return cluster;
+
+    // offset of data start in its allocation unit
+    uint32_t d = dataStartBlock_ % allocUnitBlocks_;
+
+    // no cluster starts on a boundary
+    if (d & (blocksPerCluster_ - 1))
+        return cluster;
+
+    // clusters from cluster 2 to first aligned cluster
+    uint32_t phase = (auClusters - (d >> clusterSizeShift_)) % auClusters;
+    uint32_t r = (cluster - 2) % auClusters;
+    return cluster + (phase + auClusters - r) % auClusters;
+}
+//------------------------------------------------------------------------------
+// find the smallest run of free clusters that holds count clusters
+uint8_t SdVolume::allocBestFit(uint32_t count, uint32_t* bgnCluster) {
+    // best run so far
+    uint32_t bestBgn = 0;
+    uint32_t bestCount = 0XFFFFFFFF;
+
+    // current run of free clusters
+    uint32_t runBgn = 0;
+    uint32_t runCount = 0;
+
+    // last cluster of FAT
+    uint32_t fatEnd = clusterCount_ + 1;
+
+    // clusters before allocSearchStart_ are in use
+    for (uint32_t c = allocSearchStart_; c <= (fatEnd + 1); c++) {
+        // treat cluster past end of FAT as in use to end last run
+        uint32_t f = 1;
+        if (c <= fatEnd && !allocGet(c, &f))
+            return false;
+
+        if (f == 0) {
+            if (runCount++ == 0)
+                runBgn = c;
+            continue;
+        }
+        if (runCount >= count && runCount < bestCount) {
+            bestBgn = runBgn;
+            bestCount = runCount;
+
+            // done if exact fit
+            if (runCount == count)
+                break;
+        }
+        runCount = 0;
+    }
+    if (bestBgn == 0)
+        return false;
+
+    *bgnCluster = bestBgn;
+    return true;
+}
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
-uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
+uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster, uint8_t policy) {
     // start of group
-    uint32_t bgnCluster;
-
-    // flag to save place to start next search
-    uint8_t setStart;
-
-    // set search start cluster
-    if (*curCluster) {
-        // try to make file contiguous
-        bgnCluster = *curCluster + 1;
-        // don't save new start location
-        setStart = false;
-    } 
+    uint32_t bgnCluster = 0;
+
+    if (policy == ALLOC_DEFAULT)
+        policy = allocPolicy_;
+
+    if (*curCluster && (policy == ALLOC_BEST_FIT || policy == ALLOC_AU_ALIGNED)) {
+        // extend file in place if the following clusters are free
+        uint32_t c = *curCluster + 1;
+        for (; c <= (*curCluster + count); c++) {
+            uint32_t f;
+            if (c > (clusterCount_ + 1))
+                break;
+            if (!allocGet(c, &f))
+                return false;
+            if (f != 0)
+                break;
+        }
+        if (c > (*curCluster + count))
+            bgnCluster = *curCluster + 1;
+    }
+    if (bgnCluster == 0) {
+        if (policy == ALLOC_BEST_FIT) {
+            if (!allocBestFit(count, &bgnCluster))
+                return false;
+        } else {
+            // set search start cluster
+            uint32_t start;
+            if (*curCluster && policy != ALLOC_AU_ALIGNED) {
+                // try to make file contiguous
+                start = *curCluster + 1;
+            } 
+            else if (policy == ALLOC_FIRST_FIT) {
+                // start at likely place for free cluster
+                start = allocSearchStart_;
+            }
+            else {
+                // continue after last allocation
+                start = allocRover_;
+            }
+            if (!allocFind(count, start, policy == ALLOC_AU_ALIGNED, &bgnCluster))
+                return false;
+        }
+    }
+    if (fatType_ == FAT_TYPE_EXFAT) {
+        // mark clusters in use - SdFile links them if the file has a FAT chain
+        if (!bitmapPut(bgnCluster, count, 1))
+            return false;
+    }
     else {
-        // start at likely place for free cluster
-        bgnCluster = allocSearchStart_;
+        // link clusters and mark end of chain
+        if (!fatPutRun(bgnCluster, count)) 
+            return false;
 
-        // save next search start if one cluster
-        setStart = 1 == count;
+        if (*curCluster != 0) {
+            // connect chains
+            if (!fatPut(*curCluster, bgnCluster)) 
+                return false;
+        }
     }
-    // end of group
-    uint32_t endCluster = bgnCluster;
+    if (*curCluster == 0 && policy == ALLOC_FIRST_FIT && count == 1) {
+        // remember possible next free cluster
+        allocSearchStart_ = bgnCluster + 1;
+    }
+    // next fit continues after this group
+    allocRover_ = bgnCluster + count;
 
+    // return first cluster number to caller
+    *curCluster = bgnCluster;
+
+    return true;
+}
+//------------------------------------------------------------------------------
+// find count free clusters starting the search at cluster start
+uint8_t SdVolume::allocFind(uint32_t count, uint32_t start, uint8_t align, uint32_t* bgnCluster) {
     // last cluster of FAT
     uint32_t fatEnd = clusterCount_ + 1;
 
+    if (start < 2 || start > fatEnd)
+        start = 2;
+
+    // start of group
+    uint32_t bgn = align ? allocAlign(start) : start;
+
+    // end of group
+    uint32_t end = bgn;
+
     // search the FAT for free clusters
-    for (uint32_t n = 0;; n++, endCluster++) {
+    for (uint32_t n = 0;; n++, end++) {
         // can't find space checked all clusters
         if (n >= clusterCount_) return false;
 
         // past end - start from beginning of FAT
-        if (endCluster > fatEnd) {
-            bgnCluster = endCluster = 2;
+        if (end > fatEnd) {
+            bgn = end = align ? allocAlign(2) : 2;
         }
         uint32_t f;
-        if (!fatGet(endCluster, &f)) return false;
+        if (!allocGet(end, &f)) return false;
 
         if (f != 0) {
-            // cluster in use try next cluster as bgnCluster
-            bgnCluster = endCluster + 1;
+            // cluster in use try next cluster as bgn
+            bgn = end + 1;
+            if (align) {
+                // skip clusters before next allocation unit boundary
+                bgn = allocAlign(bgn);
+                n += bgn - end - 1;
+                end = bgn - 1;
+            }
         } 
-        else if ((endCluster - bgnCluster + 1) == count) {
+        else if ((end - bgn + 1) == count) {
             // done - found space
-            break;
+            *bgnCluster = bgn;
+            return true;
         }
     }
-    // mark end of chain
-    if (!fatPutEOC(endCluster)) 
-        return false;
+}
+//------------------------------------------------------------------------------
+// Fetch the allocation state of a cluster, *value is nonzero if in use.
+// The FAT entry is used for FAT16 and FAT32, the bitmap for exFAT.
+uint8_t SdVolume::allocGet(uint32_t cluster, uint32_t* value) {
+    if (fatType_ != FAT_TYPE_EXFAT) return fatGet(cluster, value);
 
-    // link clusters
-    while (endCluster > bgnCluster) {
-        if (!fatPut(endCluster - 1, endCluster)) 
-            return false;
-        endCluster--;
+    // error if reserved cluster or not in bitmap
+    if (cluster < 2 || cluster > (clusterCount_ + 1)) return false;
+
+    // 4096 bits per bitmap block
+    uint32_t bit = cluster - 2;
+    uint32_t lba = bitmapStartBlock_ + (bit >> 12);
+    if (lba != cacheBlockNumber_) {
+        if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
     }
-    if (*curCluster != 0) {
-        // connect chains
-        if (!fatPut(*curCluster, bgnCluster)) 
-            return false;
+    *value = cacheBuffer_.data[(bit >> 3) & 0X1FF] & (1 << (bit & 7));
+    return true;
+}
+//------------------------------------------------------------------------------
+// count clear bits with index less than end in the bitmap block in the cache
+uint16_t SdVolume::bitmapCountFree(uint16_t end) const {
+    uint16_t n = 0;
+    uint16_t i = 0;
+    // whole bytes
+    for (; (i + 8) <= end; i += 8) {
+        uint8_t b = cacheBuffer_.data[i >> 3];
+        if (b == 0XFF) continue;
+        for (; b; b &= b - 1) n--;
+        n += 8;
     }
-    // return first cluster number to caller
-    *curCluster = bgnCluster;
+    for (; i < end; i++) {
+        if (!(cacheBuffer_.data[i >> 3] & (1 << (i & 7)))) n++;
+    }
+    return n;
+}
+//------------------------------------------------------------------------------
+// set the exFAT bitmap bits for count clusters starting at cluster to value
+uint8_t SdVolume::bitmapPut(uint32_t cluster, uint32_t count, uint8_t value) {
+    // error if reserved cluster, empty run or not in bitmap
+    if (cluster < 2 || count == 0 || (cluster + count - 1) > (clusterCount_ + 1))
+        return false;
 
-    // remember possible next free cluster
-    if (setStart) 
-        allocSearchStart_ = bgnCluster + 1;
+    // keep search start at or before first free cluster
+    if (!value && cluster < allocSearchStart_) allocSearchStart_ = cluster;
+
+    uint32_t bit = cluster - 2;
+    uint32_t end = bit + count;
+    while (bit < end) {
+        if (!cacheRawBlock(bitmapStartBlock_ + (bit >> 12), CACHE_FOR_WRITE))
+            return false;
+
+        // end of run in this block
+        uint32_t last = (bit | 0XFFF) + 1;
+        if (last > end) last = end;
 
+        while (bit < last) {
+            uint8_t* p = cacheBuffer_.data + ((bit >> 3) & 0X1FF);
+            if ((bit & 7) == 0 && (last - bit) >= 8) {
+                // whole byte
+                *p = value ? 0XFF : 0;
+                bit += 8;
+            } else {
+                if (value) {
+                    *p |= 1 << (bit & 7);
+                } else {
+                    *p &= ~(1 << (bit & 7));
+                }
+                bit++;
+            }
+        }
+    }
     return true;
 }
 //------------------------------------------------------------------------------
@@ -100,6 +274,8 @@ uint8_t SdVolume::cacheFlush(void) {
 }
 //------------------------------------------------------------------------------
 uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
+    if (action == CACHE_FOR_WRITE && !writeBegin()) 
+        return false;
     if (cacheBlockNumber_ != blockNumber) {
         if (!cacheFlush()) 
             return false;
@@ -113,7 +289,7 @@ uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
 //------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-    if (!cacheFlush()) return false;
+    if (!writeBegin() || !cacheFlush()) return false;
 
     // loop take less flash than memset(cacheBuffer_.data, 0, 512);
     for (uint16_t i = 0; i < 512; i++) {
@@ -125,25 +301,114 @@ uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
 }
 //------------------------------------------------------------------------------
 // return the size in bytes of a cluster chain
-uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) const {
-    uint32_t s = 0;
-    do {
-        if (!fatGet(cluster, &cluster)) return false;
-        s += 512UL << clusterSizeShift_;
-    } while (!isEOC(cluster));
-    *size = s;
+uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) {
+    uint32_t n = 0XFFFFFFFF;
+    if (!fatFollow(&cluster, &n, CACHE_FOR_READ)) return false;
+    *size = n << (clusterSizeShift_ + 9);
     return true;
 }
 //------------------------------------------------------------------------------
+// forget the end of file clusters of all files
+void SdVolume::endClusterClear(void) {
+#if END_CLUSTER_CACHE_SIZE
+    for (uint8_t i = 0; i < END_CLUSTER_CACHE_SIZE; i++) {
+        endCache_[i].firstCluster = 0;
+    }
+    endCacheNext_ = 0;
+#endif  // END_CLUSTER_CACHE_SIZE
+}
+//------------------------------------------------------------------------------
+// find a remembered cluster of the file with the directory entry at
+// dirBlock and dirIndex.  The cluster index must not be past *index.
+uint8_t SdVolume::endClusterGet(uint32_t dirBlock, uint8_t dirIndex,
+    uint32_t firstCluster, uint32_t* index, uint32_t* cluster) const {
+#if END_CLUSTER_CACHE_SIZE
+    for (uint8_t i = 0; i < END_CLUSTER_CACHE_SIZE; i++) {
+        const endCluster_t* e = endCache_ + i;
+        if (e->firstCluster == firstCluster && e->dirBlock == dirBlock
+            && e->dirIndex == dirIndex && e->index <= *index) {
+            *index = e->index;
+            *cluster = e->cluster;
+            return true;
+        }
+    }
+#endif  // END_CLUSTER_CACHE_SIZE
+    return false;
+}
+//------------------------------------------------------------------------------
+// remember the cluster with the given index in a file's chain, a cluster
+// of zero forgets the file
+void SdVolume::endClusterPut(uint32_t dirBlock, uint8_t dirIndex,
+    uint32_t firstCluster, uint32_t index, uint32_t cluster) {
+#if END_CLUSTER_CACHE_SIZE
+    endCluster_t* e = 0;
+    for (uint8_t i = 0; i < END_CLUSTER_CACHE_SIZE; i++) {
+        if (endCache_[i].firstCluster && endCache_[i].dirBlock == dirBlock
+            && endCache_[i].dirIndex == dirIndex) {
+            e = endCache_ + i;
+            break;
+        }
+    }
+    if (!cluster) {
+        if (e) e->firstCluster = 0;
+        return;
+    }
+    if (!e) {
+        // replace the oldest entry
+        e = endCache_ + endCacheNext_;
+        if (++endCacheNext_ >= END_CLUSTER_CACHE_SIZE) endCacheNext_ = 0;
+    }
+    e->dirBlock = dirBlock;
+    e->dirIndex = dirIndex;
+    e->firstCluster = firstCluster;
+    e->index = index;
+    e->cluster = cluster;
+#endif  // END_CLUSTER_CACHE_SIZE
+}
+//------------------------------------------------------------------------------
+// count free entries with index bgn <= i < end in the FAT block in the cache
+uint16_t SdVolume::fatCountFree(uint16_t bgn, uint16_t end) const {
+    uint16_t n = 0;
+    if (fat16()) {
+        uint16_t i = bgn;
+        // odd first entry is the high half of a word
+        if ((i & 1) && i < end) {
+            if (cacheBuffer_.fat16[i] == 0) n++;
+            i++;
+        }
+        // test two entries per 32-bit word
+        for (; (i + 1) < end; i += 2) {
+            uint32_t w = cacheBuffer_.fat32[i >> 1];
+            if (w == 0) {
+                n += 2;
+            } else {
+                if ((w & 0XFFFF) == 0) n++;
+                if ((w >> 16) == 0) n++;
+            }
+        }
+        if (i < end && cacheBuffer_.fat16[i] == 0) n++;
+    } else {
+        for (uint16_t i = bgn; i < end; i++) {
+            if ((cacheBuffer_.fat32[i] & FAT32MASK) == 0) n++;
+        }
+    }
+    return n;
+}
+//------------------------------------------------------------------------------
+// follow a cluster chain, see fatWalk()
+uint8_t SdVolume::fatFollow(uint32_t* cluster, uint32_t* count, uint8_t action) {
+    if (fat16()) return fatWalk<uint16_t>(cluster, count, action);
+    return fatWalk<uint32_t>(cluster, count, action);
+}
+//------------------------------------------------------------------------------
 // Fetch a FAT entry
-uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
+uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) {
     if (cluster > (clusterCount_ + 1)) return false;
-    uint32_t lba = fatStartBlock_;
-    lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
+    uint32_t lba = fatStartBlock_ + (cluster >> fatEntryShift_);
     if (lba != cacheBlockNumber_) {
         if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
     }
-    if (fatType_ == 16)
+    if (fat16())
         *value = cacheBuffer_.fat16[cluster & 0XFF];
     else
         *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
@@ -155,19 +420,21 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
     // error if reserved cluster
     if (cluster < 2) 
         return false;
+
+    if (!writeBegin()) 
+        return false;
     
     // error if not in FAT
     if (cluster > (clusterCount_ + 1)) 
         return false;
     
     // calculate block address for entry
-    uint32_t lba = fatStartBlock_;
-    lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
+    uint32_t lba = fatStartBlock_ + (cluster >> fatEntryShift_);
     
     if (lba != cacheBlockNumber_) 
         if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
     // store entry
-    if (fatType_ == 16) 
+    if (fat16()) 
         cacheBuffer_.fat16[cluster & 0XFF] = value;
     else 
         cacheBuffer_.fat32[cluster & 0X7F] = value;
@@ -179,24 +446,264 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
     return true;
 }
 //------------------------------------------------------------------------------
-// free a cluster chain
-uint8_t SdVolume::freeChain(uint32_t cluster) {
-    // clear free cluster location
-    allocSearchStart_ = 2;
+/**
+ * Count the free clusters on the volume.
+ *
+ * The FAT is read with a single multiple block read into the cache buffer,
+ * the cache is written if dirty and then invalidated.  See
+ * freeClusterCountStep() to spread the count over many calls.
+ *
+ * \return The number of free clusters or -1 if an error occurs.
+ * Reasons for failure include the volume is not initialized, is FAT12
+ * or an I/O error.
+ */
+int32_t SdVolume::freeClusterCount(void) {
+    uint32_t count;
+    freeClusterCountBegin();
+    return freeClusterCountStep(0XFFFFFFFF, &count) == 1 ? count : -1;
+}
+//------------------------------------------------------------------------------
+/**
+ * Continue an incremental count of free clusters.
+ *
+ * Call freeClusterCountBegin() to start a count then call
+ * freeClusterCountStep() until it returns one.  Clusters allocated or
+ * freed in the part of the FAT already scanned are not reflected
+ * in the result.
+ *
+ * \param[in] blockCount Maximum number of FAT blocks to read in this call.
+ *
+ * \param[out] count The number of free clusters when the count is complete.
+ *
+ * \return One if the count is complete, zero if more FAT blocks must be
+ * read or -1 if an error occurs.
+ */
+int8_t SdVolume::freeClusterCountStep(uint32_t blockCount, uint32_t* count) {
+    // error if volume is not initialized
+    if (fatType_ == 0) return -1;
 
-    do {
-        uint32_t next;
-        if (!fatGet(cluster, &next)) return false;
+    // count FAT entries or exFAT bitmap bits
+    uint8_t exFat = fatType_ == FAT_TYPE_EXFAT;
+
+    // entries per block
+    uint16_t perBlock = exFat ? 4096 : 1 << fatEntryShift_;
+
+    // FAT entries zero and one are reserved, bitmap starts at cluster two
+    uint32_t fatEntries = exFat ? clusterCount_ : clusterCount_ + 2;
+    uint32_t endBlock = (fatEntries + perBlock - 1)/perBlock;
 
-        // free cluster
-        if (!fatPut(cluster, 0)) return false;
+    if (freeScanBlock_ < endBlock) {
+        // no read in this call
+        if (blockCount == 0)
+            return 0;
+        if (blockCount > (endBlock - freeScanBlock_))
+            blockCount = endBlock - freeScanBlock_;
 
-        cluster = next;
-    } while (!isEOC(cluster));
+        // use cache as scratch buffer
+        if (!cacheFlush())
+            return -1;
+        cacheBlockNumber_ = 0XFFFFFFFF;
+
+        uint32_t startBlock = exFat ? bitmapStartBlock_ : fatStartBlock_;
+        if (!sdCard_->readStart(startBlock + freeScanBlock_))
+            return -1;
+        while (blockCount--) {
+            if (!sdCard_->readData(cacheBuffer_.data)) {
+                // end the read sequence, the card does not track it
+                sdCard_->readStop();
+                return -1;
+            }
+            uint32_t first = freeScanBlock_ * perBlock;
+            uint16_t end = (fatEntries - first) < perBlock ? fatEntries - first : perBlock;
+            if (exFat) {
+                freeScanCount_ += bitmapCountFree(end);
+            } else {
+                freeScanCount_ += fatCountFree(first < 2 ? 2 : 0, end);
+            }
+            freeScanBlock_++;
+        }
+        if (!sdCard_->readStop())
+            return -1;
+    }
+    if (freeScanBlock_ < endBlock)
+        return 0;
+    *count = freeScanCount_;
+    return 1;
+}
+//------------------------------------------------------------------------------
+/**
+ * Count runs of free clusters and find the length distribution of the runs.
+ *
+ * Long free runs allow fast contiguous writes.  Many short runs mean new
+ * files will be fragmented.
+ *
+ * \param[out] hist If not null, hist[i] is set to the number of free runs
+ * with a length of 2^i to 2^(i+1) - 1 clusters.  The last bin also counts
+ * all longer runs.
+ *
+ * \param[in] bins The number of entries in \a hist.
+ *
+ * \param[out] largest If not null, set to the length of the longest free run.
+ *
+ * \return The number of free runs or -1 if an error occurs.
+ * Reasons for failure include the volume is not initialized or an I/O error.
+ */
+int32_t SdVolume::freeRunCount(uint32_t* hist, uint8_t bins, uint32_t* largest) {
+    if (fatType_ == 0) return -1;
+
+    // no histogram without an array for it
+    if (!hist)
+        bins = 0;
+    for (uint8_t i = 0; i < bins; i++) hist[i] = 0;
+    uint32_t runs = 0;
+    uint32_t maxRun = 0;
+    uint32_t runCount = 0;
+
+    // last cluster of FAT
+    uint32_t fatEnd = clusterCount_ + 1;
 
+    for (uint32_t c = 2; c <= (fatEnd + 1); c++) {
+        // treat cluster past end of FAT as in use to end last run
+        uint32_t f = 1;
+        if (c <= fatEnd && !allocGet(c, &f))
+            return -1;
+
+        if (f == 0) {
+            runCount++;
+            continue;
+        }
+        if (runCount == 0)
+            continue;
+
+        runs++;
+        if (runCount > maxRun)
+            maxRun = runCount;
+        if (bins) {
+            // bin is floor(log2(runCount))
+            uint8_t b = 0;
+            while (b < (bins - 1) && (runCount >> (b + 1)))
+                b++;
+            hist[b]++;
+        }
+        runCount = 0;
+    }
+    if (largest)
+        *largest = maxRun;
+    return runs;
+}
+//------------------------------------------------------------------------------
+// Link count clusters starting at cluster into a chain that ends with EOC.
+// Each FAT block in the run is cached and marked dirty once.
+uint8_t SdVolume::fatPutRun(uint32_t cluster, uint32_t count) {
+    // last cluster of run
+    uint32_t endCluster = cluster + count - 1;
+
+    // error if reserved cluster, empty run or not in FAT
+    if (cluster < 2 || count == 0 || endCluster > (clusterCount_ + 1)) 
+        return false;
+
+    // entry index mask for a FAT block
+    uint8_t mask = (1 << fatEntryShift_) - 1;
+
+    while (cluster <= endCluster) {
+        // calculate block address for entry
+        uint32_t lba = fatStartBlock_ + (cluster >> fatEntryShift_);
+
+        if (!cacheRawBlock(lba, CACHE_FOR_WRITE)) 
+            return false;
+
+        // mirror second FAT
+        if (fatCount_ > 1) 
+            cacheMirrorBlock_ = lba + blocksPerFat_;
+
+        // last cluster of run in this block
+        uint32_t last = cluster | mask;
+        if (last > endCluster) 
+            last = endCluster;
+
+        // store entries
+        if (fat16()) {
+            for (; cluster < last; cluster++) {
+                cacheBuffer_.fat16[cluster & 0XFF] = cluster + 1;
+            }
+            cacheBuffer_.fat16[cluster & 0XFF] = cluster == endCluster ? FAT16EOC : cluster + 1;
+        } else {
+            for (; cluster < last; cluster++) {
+                cacheBuffer_.fat32[cluster & 0X7F] = cluster + 1;
+            }
+            cacheBuffer_.fat32[cluster & 0X7F] = cluster != endCluster ? cluster + 1
+                : fatType_ == FAT_TYPE_EXFAT ? EXFAT_EOC : FAT32EOC;
+        }
+        cluster++;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// Follow at most *count links of the chain at *cluster for a FAT with
+// entries of type entry_t.  Links that stay in the cached FAT block are
+// followed without another cache lookup.  Each cluster passed is freed
+// if action is CACHE_FOR_WRITE.  On return *cluster is the last entry
+// read, EOC at end of chain, and *count is the number of links followed.
+template <typename entry_t>
+uint8_t SdVolume::fatWalk(uint32_t* cluster, uint32_t* count, uint8_t action) {
+    // FAT entries per block is 1 << shift
+    uint8_t const shift = sizeof(entry_t) == 2 ? 8 : 7;
+    uint16_t const mask = (1 << shift) - 1;
+    uint32_t c = *cluster;
+    uint32_t n = 0;
+
+    while (n < *count && c < fatEOCMin_) {
+        uint32_t fatBlock = c >> shift;
+        uint32_t lba = fatStartBlock_ + fatBlock;
+        if (!cacheRawBlock(lba, action)) return false;
+
+        // mirror second FAT
+        if (action == CACHE_FOR_WRITE && fatCount_ > 1)
+            cacheMirrorBlock_ = lba + blocksPerFat_;
+
+        entry_t* fat = reinterpret_cast<entry_t*>(cacheBuffer_.data);
+        do {
+            // error if reserved cluster or not in FAT
+            if (c < 2 || c > (clusterCount_ + 1)) return false;
+
+            uint32_t next = fat[c & mask];
+            if (sizeof(entry_t) == 4) next &= FAT32MASK;
+
+            if (action == CACHE_FOR_WRITE) {
+                fat[c & mask] = 0;
+
+                // keep search start at or before first free cluster
+                if (c < allocSearchStart_) allocSearchStart_ = c;
+            }
+            n++;
+            c = next;
+        } while (n < *count && c < fatEOCMin_ && (c >> shift) == fatBlock);
+    }
+    *cluster = c;
+    *count = n;
     return true;
 }
 //------------------------------------------------------------------------------
+// free a cluster chain
+uint8_t SdVolume::freeChain(uint32_t cluster) {
+    if (fatType_ == FAT_TYPE_EXFAT) {
+        // exFAT FAT entries of free clusters are not used, clear the bitmap
+        // for each run of contiguous clusters in the chain
+        do {
+            uint32_t bgn = cluster;
+            uint32_t n = 0;
+            do {
+                if (!fatGet(cluster, &cluster)) return false;
+                n++;
+            } while (cluster == (bgn + n));
+            if (!bitmapPut(bgn, n, 0)) return false;
+        } while (!isEOC(cluster));
+        return true;
+    }
+    uint32_t n = 0XFFFFFFFF;
+    return fatFollow(&cluster, &n, CACHE_FOR_WRITE);
+}
+//------------------------------------------------------------------------------
 /**
  * Initialize a FAT volume.
  *
@@ -215,6 +722,9 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
 uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     uint32_t volumeStartBlock = 0;
     sdCard_ = dev;
+    freeClusterCountBegin();
+    endClusterClear();
+    allocRover_ = allocSearchStart_ = 2;
     // if part == 0 assume super floppy with FAT boot sector in block zero
     // if part > 0 assume mbr volume with partition table
     if (part) {
@@ -241,6 +751,14 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
         SerialUSB.println("Error: SdVolume::init() Cache for read2");
         return false;
     }
+    volumeStartBlock_ = volumeStartBlock;
+    if (!memcmp(cacheBuffer_.xbs.oemName, "EXFAT   ", 8)) {
+        if (!initExFat(volumeStartBlock)) 
+            return false;
+        // remember card and volume for remount()
+        volumeIdValid_ = readVolumeId(&cardSerial_, &volumeSerial_);
+        return true;
+    }
 
     bpb_t* bpb = &cacheBuffer_.fbs.bpb;
     if (bpb->bytesPerSector != 512 || bpb->fatCount == 0 || bpb->reservedSectorCount == 0 || bpb->sectorsPerCluster == 0) {
@@ -290,5 +808,292 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
         rootDirStart_ = bpb->fat32RootCluster;
         fatType_ = 32;
     }
+    // select FAT entry width once so FAT access does not test fatType_
+    if (FAT16_SUPPORT && fatType_ == 16) {
+        fatEntryShift_ = 8;
+        fatEOCMin_ = FAT16EOC_MIN;
+    }
+    else if (FAT32_SUPPORT && fatType_ == 32) {
+        fatEntryShift_ = 7;
+        fatEOCMin_ = FAT32EOC_MIN;
+    }
+    else {
+        fatType_ = 0;
+        SerialUSB.println("Error: SdVolume::init() unsupported FAT type");
+        return false;
+    }
+    // a clean volume is marked dirty before its first change
+    if (!cacheRawBlock(fatStartBlock_, CACHE_FOR_READ)) 
+        return false;
+    if (fat16()) {
+        wasClean_ = (cacheBuffer_.fat16[1] & FAT16_CLEAN_SHUTDOWN) != 0;
+    } else {
+        wasClean_ = (cacheBuffer_.fat32[1] & FAT32_CLEAN_SHUTDOWN) != 0;
+    }
+    volumeDirty_ = !wasClean_;
+
+    // remember card and volume for remount(), only remount() fails
+    // if the card's CID or the boot sector can't be read
+    volumeIdValid_ = readVolumeId(&cardSerial_, &volumeSerial_);
+    return true;
+}
+//------------------------------------------------------------------------------
+// Initialize an exFAT volume, the boot sector is in the cache
+uint8_t SdVolume::initExFat(uint32_t volumeStartBlock) {
+    xbs_t* xbs = &cacheBuffer_.xbs;
+
+    // exFAT uses the FAT32 access functions with 32-bit entries
+    if (!FAT32_SUPPORT || xbs->bytesPerSectorShift != 9 || xbs->sectorsPerClusterShift > 8
+        || xbs->numberOfFats == 0 || xbs->clusterCount >= (FAT32EOC_MIN - 1)) {
+        SerialUSB.println("Error: SdVolume::init() unsupported exFAT volume");
+        return false;
+    }
+    clusterSizeShift_ = xbs->sectorsPerClusterShift;
+    blocksPerCluster_ = 1 << clusterSizeShift_;
+
+    // a clean volume is marked dirty before its first change
+    wasClean_ = !(xbs->volumeFlags & EXFAT_VOLUME_DIRTY);
+    volumeDirty_ = !wasClean_;
+
+    // only the first FAT is used, the second is for TexFAT
+    fatCount_ = 1;
+    blocksPerFat_ = xbs->fatLength;
+    fatStartBlock_ = volumeStartBlock + xbs->fatOffset;
+    dataStartBlock_ = volumeStartBlock + xbs->clusterHeapOffset;
+    clusterCount_ = xbs->clusterCount;
+    rootDirEntryCount_ = 0;
+    rootDirStart_ = xbs->rootDirectoryCluster;
+    fatType_ = FAT_TYPE_EXFAT;
+    fatEntryShift_ = 7;
+    fatEOCMin_ = FAT32EOC_MIN;
+
+    // find the allocation bitmap in the root directory
+    uint32_t bitmapCluster = 0;
+    uint32_t bitmapSize = 0;
+    for (uint32_t c = rootDirStart_; !bitmapCluster && !isEOC(c);) {
+        for (uint16_t b = 0; b < blocksPerCluster_ && !bitmapCluster; b++) {
+            if (!cacheRawBlock(clusterStartBlock(c) + b, CACHE_FOR_READ)) 
+                return false;
+            for (uint8_t i = 0; i < 16; i++) {
+                xdb_t* d = reinterpret_cast<xdb_t*>(cacheBuffer_.dir + i);
+                if (d->type == EXFAT_TYPE_END) 
+                    break;
+                if (d->type == EXFAT_TYPE_BITMAP && !(d->flags & 1)) {
+                    bitmapCluster = d->firstCluster;
+                    bitmapSize = d->dataLength;
+                    break;
+                }
+            }
+        }
+        if (!fatGet(c, &c)) 
+            return false;
+    }
+    if (!bitmapCluster || bitmapSize < ((clusterCount_ + 7) >> 3)) {
+        SerialUSB.println("Error: SdVolume::init() no exFAT bitmap");
+        fatType_ = 0;
+        return false;
+    }
+    // bitmap is accessed by block number so it must be contiguous
+    uint32_t n = ((bitmapSize - 1) >> (clusterSizeShift_ + 9)) + 1;
+    for (uint32_t c = bitmapCluster; --n;) {
+        uint32_t next;
+        if (!fatGet(c, &next) || next != (c + 1)) {
+            SerialUSB.println("Error: SdVolume::init() exFAT bitmap not contiguous");
+            fatType_ = 0;
+            return false;
+        }
+        c = next;
+    }
+    bitmapStartBlock_ = clusterStartBlock(bitmapCluster);
+    return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Write all cached data and mark the volume clean on the card.  Call
+ * markClean() after files have been closed or synced and before power
+ * is removed.  The next change to the volume marks it dirty again.
+ *
+ * See wasClean().
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  Reasons for
+ * failure include the volume is not initialized or an I/O error.
+ */
+uint8_t SdVolume::markClean(void) {
+    // error if volume is not initialized
+    if (fatType_ == 0) 
+        return false;
+    if (!cacheSync()) 
+        return false;
+    return !volumeDirty_ || volumeStatePut(0);
+}
+//------------------------------------------------------------------------------
+// Read count blocks starting at block with one multiple block read.
+// The read is left open so the next run can continue it.  A dirty copy
+// of one of the blocks in the cache is written first.
+uint8_t SdVolume::readBlocks(uint32_t block, uint32_t count, uint8_t* dst) {
+    if ((cacheBlockNumber_ - block) < count && !cacheFlush()) 
+        return false;
+    return sdCard_->readBlocks(block, count, dst);
+}
+//------------------------------------------------------------------------------
+// read the card's CID serial number and the boot sector's volume serial number
+uint8_t SdVolume::readVolumeId(uint32_t* cardSerial, uint32_t* volumeSerial) {
+    cid_t cid;
+    uint8_t id[5];
+    uint8_t sig[2];
+
+    if (!sdCard_->readCID(&cid)) 
+        return false;
+    *cardSerial = cid.psn;
+
+    // exFAT has the serial number at 100, FAT after the extended boot
+    // signature at 38 or 66
+    uint16_t offset = fatType_ == FAT_TYPE_EXFAT ? 99 : fatType_ == 16 ? 38 : 66;
+
+    // the serial number then the signature in one read of the boot sector
+    uint8_t partial = sdCard_->partialBlockRead();
+    sdCard_->partialBlockRead(true);
+    uint8_t rtn = sdCard_->readData(volumeStartBlock_, offset, 5, id) 
+        && sdCard_->readData(volumeStartBlock_, 510, 2, sig);
+    sdCard_->partialBlockRead(partial);
+
+    // boot sector must have a signature
+    if (!rtn || sig[0] != BOOTSIG0 || sig[1] != BOOTSIG1) 
+        return false;
+    if (fatType_ == FAT_TYPE_EXFAT || id[0] == EXTENDED_BOOT_SIG) {
+        memcpy(volumeSerial, id + 1, 4);
+    } else {
+        *volumeSerial = 0;
+    }
     return true;
 }
+//------------------------------------------------------------------------------
+/**
+ * Remount a volume after its card has been initialized again by
+ * Sd2Card::init(), for example after the card was power cycled.
+ *
+ * The geometry, free cluster count and allocation state from the last
+ * init() are kept, so only the card's CID and the boot sector are read.
+ * Files that were open on the volume remain valid.
+ *
+ * \param[in] dev The Sd2Card where the volume is located.
+ *
+ * \return The value one, true, is returned if the card and volume are
+ * the ones found by the last init().  The value zero, false, is returned
+ * if the card or volume has changed, the volume was not initialized,
+ * init() could not read the card's CID or the boot sector's signature
+ * or an I/O error occurs.  Call init() after a failure.
+ */
+uint8_t SdVolume::remount(Sd2Card* dev) {
+    uint32_t cardSerial;
+    uint32_t volumeSerial;
+
+    // error if volume is not initialized
+    if (fatType_ == 0) 
+        return false;
+
+    sdCard_ = dev;
+    if (!volumeIdValid_ || !readVolumeId(&cardSerial, &volumeSerial) 
+        || cardSerial != cardSerial_ || volumeSerial != volumeSerial_) {
+        // don't write the cached block to a different volume
+        cacheDirty_ = 0;
+        cacheMirrorBlock_ = 0;
+        cacheBlockNumber_ = 0XFFFFFFFF;
+        endClusterClear();
+        fatType_ = 0;
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+// Write the volume's dirty state to the card.  FAT16 and FAT32 keep a
+// clean shutdown bit in FAT[1], exFAT keeps a dirty bit in the boot sector.
+uint8_t SdVolume::volumeStatePut(uint8_t dirty) {
+    // error if volume is not initialized
+    if (fatType_ == 0) 
+        return false;
+
+    // allow the cache writes below without marking the volume again
+    volumeDirty_ = 1;
+
+    if (fatType_ == FAT_TYPE_EXFAT) {
+#if SD_PROTECT_BLOCK_ZERO
+        // a boot sector in block zero can't be written
+        if (volumeStartBlock_ == 0) {
+            volumeDirty_ = dirty;
+            return true;
+        }
+#endif  // SD_PROTECT_BLOCK_ZERO
+        if (!cacheRawBlock(volumeStartBlock_, CACHE_FOR_WRITE)) 
+            return false;
+        if (dirty) {
+            cacheBuffer_.xbs.volumeFlags |= EXFAT_VOLUME_DIRTY;
+        } else {
+            cacheBuffer_.xbs.volumeFlags &= ~EXFAT_VOLUME_DIRTY;
+        }
+    }
+    else {
+        if (!cacheRawBlock(fatStartBlock_, CACHE_FOR_WRITE)) 
+            return false;
+
+        // mirror second FAT
+        if (fatCount_ > 1) 
+            cacheMirrorBlock_ = fatStartBlock_ + blocksPerFat_;
+
+        if (fat16()) {
+            if (dirty) {
+                cacheBuffer_.fat16[1] &= ~FAT16_CLEAN_SHUTDOWN;
+            } else {
+                cacheBuffer_.fat16[1] |= FAT16_CLEAN_SHUTDOWN;
+            }
+        } else {
+            if (dirty) {
+                cacheBuffer_.fat32[1] &= ~FAT32_CLEAN_SHUTDOWN;
+            } else {
+                cacheBuffer_.fat32[1] |= FAT32_CLEAN_SHUTDOWN;
+            }
+        }
+    }
+    // state must be on the card before any other change
+    if (!cacheSync()) 
+        return false;
+    volumeDirty_ = dirty;
+    return true;
+}
+//------------------------------------------------------------------------------
+// Write count blocks starting at block with one multiple block write.
+// The write is left open so the next run can continue it.  A copy of
+// one of the blocks in the cache is dropped since it will be overwritten.
+uint8_t SdVolume::writeBlocks(uint32_t block, uint32_t count, const uint8_t* src) {
+    if (!writeBegin()) 
+        return false;
+    if ((cacheBlockNumber_ - block) < count) {
+        cacheDirty_ = 0;
+        cacheBlockNumber_ = 0XFFFFFFFF;
+    }
+    return sdCard_->writeBlocks(block, count, src);
+}
+//------------------------------------------------------------------------------
+// Zero count blocks starting at blockNumber.  The first block is left
+// dirty in the cache, the rest are written with one multiple block write.
+// Only new directory clusters are zeroed, no file is extended past its
+// end without writing its data.
+uint8_t SdVolume::zeroBlocks(uint32_t blockNumber, uint32_t count) {
+    if (!cacheZeroBlock(blockNumber)) 
+        return false;
+    if (count < 2) 
+        return true;
+
+    // cache is all zero, send it for each of the other blocks
+    if (!sdCard_->writeStart(blockNumber + 1, count - 1)) 
+        return false;
+    for (uint32_t i = 1; i < count; i++) {
+        if (!sdCard_->writeData(cacheBuffer_.data)) {
+            // send stop token, the card does not track this write
+            sdCard_->writeStop();
+            return false;
+        }
+    }
+    return sdCard_->writeStop();
+}